@@ -1,10 +1,14 @@
 #pragma once
 
 #include <ncurses.h>
+#include <algorithm>
+#include <functional>
 #include <string>
 #include <sstream>
 #include <map>
 #include <vector>
+#include <new>
+#include <utility>
 
 ////////////////////////////////// MACROS ////////////////////////////////////
 
@@ -19,6 +23,57 @@
                               y = ((y) / 2) - 1;       \
                             }
 
+/*
+ * Built with VEXES_COUNT_CALLS (make COUNT_CALLS=1), the curses calls that
+ * do the drawing go through counted versions instead, for everything that
+ * includes this header, app and library alike. Each call is counted by
+ * where it was made from and by the Panel whose window it went to, and the
+ * totals are written to VEXES_CALL_REPORT (or stderr) when the Engine shuts
+ * down. The counted versions call the real ones, so nothing else changes.
+ * In C++, curses makes move() and refresh() real functions rather than
+ * macros (so they can't trip up std::move), which can't be counted, so use
+ * wmove(stdscr, ...) and wrefresh(stdscr) where it matters.
+ */
+#ifdef VEXES_COUNT_CALLS
+int countedWmove(WINDOW * win, int y, int x, const char * file, int line, const char * caller);
+int countedWaddch(WINDOW * win, chtype ch, const char * file, int line, const char * caller);
+int countedWaddstr(WINDOW * win, const char * str, const char * file, int line, const char * caller);
+int countedWaddnstr(WINDOW * win, const char * str, int n, const char * file, int line,
+                    const char * caller);
+int countedWattron(WINDOW * win, int attrs, const char * file, int line, const char * caller);
+int countedWattroff(WINDOW * win, int attrs, const char * file, int line, const char * caller);
+int countedWrefresh(WINDOW * win, const char * file, int line, const char * caller);
+int countedWnoutrefresh(WINDOW * win, const char * file, int line, const char * caller);
+WINDOW * countedNewwin(int lines, int columns, int y, int x, const char * file, int line,
+                       const char * caller);
+int countedDelwin(WINDOW * win, const char * file, int line, const char * caller);
+
+// curses defines some of these as macros itself, like addstr() on top of
+// waddnstr(), which then expand to the counted versions too
+#undef wmove
+#undef waddch
+#undef waddstr
+#undef waddnstr
+#undef wattron
+#undef wattroff
+#undef wrefresh
+#undef wnoutrefresh
+#undef newwin
+#undef delwin
+
+#define VEXES_CALL_SITE                 __FILE__, __LINE__, __func__
+#define wmove(win, y, x)                countedWmove((win), (y), (x), VEXES_CALL_SITE)
+#define waddch(win, ch)                 countedWaddch((win), (ch), VEXES_CALL_SITE)
+#define waddstr(win, str)               countedWaddstr((win), (str), VEXES_CALL_SITE)
+#define waddnstr(win, str, n)           countedWaddnstr((win), (str), (n), VEXES_CALL_SITE)
+#define wattron(win, attrs)             countedWattron((win), (attrs), VEXES_CALL_SITE)
+#define wattroff(win, attrs)            countedWattroff((win), (attrs), VEXES_CALL_SITE)
+#define wrefresh(win)                   countedWrefresh((win), VEXES_CALL_SITE)
+#define wnoutrefresh(win)               countedWnoutrefresh((win), VEXES_CALL_SITE)
+#define newwin(lines, columns, y, x)    countedNewwin((lines), (columns), (y), (x), VEXES_CALL_SITE)
+#define delwin(win)                     countedDelwin((win), VEXES_CALL_SITE)
+#endif
+
 ///////////////////////////////// STRUCTS ////////////////////////////////////
 
 /*
@@ -73,6 +128,13 @@ struct Box {
     Box(Point ulIn, Point urIn, Point llIn, Point lrIn) :
         ul(ulIn), ur(urIn), ll(llIn), lr(lrIn) {}
 
+    static bool boxesAreEqual(Box a, Box b) {
+        return a.ul.x == b.ul.x && a.ul.y == b.ul.y &&
+               a.ur.x == b.ur.x && a.ur.y == b.ur.y &&
+               a.ll.x == b.ll.x && a.ll.y == b.ll.y &&
+               a.lr.x == b.lr.x && a.lr.y == b.lr.y;
+    }
+
 };
 
 /////////////////////////////// DRAWING UTILS ////////////////////////////////
@@ -80,7 +142,7 @@ struct Box {
 // Drawing functions can take an optional WINDOW *, otherwise use stdscr
 
 // Get attributes by a friendly, human-readable name
-int getAttribute(std::string name);
+int getAttribute(const std::string & name);
 
 // Combine an arbitrary amount of attributes into one attribute
 // The first parameter tells the function how many attributes to expect
@@ -89,11 +151,14 @@ int combineAttributes(int num, ...);
 // Draw character at a given point.
 void drawCharAtPoint(char ch, Point p, WINDOW * win = NULL);
 
-// Draw string at a given point
-void drawStringAtPoint(std::string text, Point p, WINDOW * win = NULL);
+// Draw string at a given point. Literals go straight to curses, without
+// being copied into a std::string first.
+void drawStringAtPoint(const std::string & text, Point p, WINDOW * win = NULL);
+void drawStringAtPoint(const char * text, Point p, WINDOW * win = NULL);
 
 // Draw a string centered on a given point
-void drawCenteredStringAtPoint(std::string text, Point p, WINDOW * win = NULL);
+void drawCenteredStringAtPoint(const std::string & text, Point p, WINDOW * win = NULL);
+void drawCenteredStringAtPoint(const char * text, Point p, WINDOW * win = NULL);
 
 // Set attributes for the given WINDOW (or default to stdscr)
 void setAttributes(int attr, WINDOW * win = NULL);
@@ -128,8 +193,346 @@ void fillBoxWithChar(Box b, char ch, WINDOW * win = NULL);
 // I do this instead of using clear() to avoid latency issues
 void clearBox(Box b, WINDOW * win = NULL);
 
+//////////////////////////////// INPUT UTILS /////////////////////////////////
+
+// Input functions can take an optional WINDOW *, otherwise use stdscr
+
+// Read a key like wgetch() would, but through the Engine's input log, so it
+// can be recorded or replayed. Use this instead of getch() and wgetch().
+// With more than one terminal open, reading stdscr takes keys from all of
+// them, and the one the key came from is left selected. Reading a Panel's or
+// Form's window only takes keys from the terminal it was made on.
+int getInput(WINDOW * win = NULL);
+
+// After getInput() returns KEY_MOUSE, fetch the event. Use this instead of
+// getmouse(), since replayed mouse events never went through curses.
+bool getMouseInput(MEVENT & event);
+
+////////////////////////////////// METRICS ///////////////////////////////////
+
+/*
+ * A Histogram counts values in buckets that get wider as the values grow,
+ * the way HdrHistogram does: each doubling is split into 16 buckets, so any
+ * value is known to within about 6%, from 1 all the way up, in a fixed 8KB.
+ * Recording never allocates, so it's cheap enough to do on every frame.
+ */
+class Histogram {
+
+private:
+    static const int subBucketBits = 4;
+    static const int subBuckets = 1 << subBucketBits;
+    static const int bucketCount = (64 - subBucketBits + 1) * subBuckets;
+
+    unsigned long long counts[bucketCount];
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long minimum;
+    unsigned long long maximum;
+
+    static int bucketFor(unsigned long long value);
+    static unsigned long long bucketStart(int bucket);
+
+public:
+    Histogram();
+
+    void record(unsigned long long value);
+    void reset();
+
+    unsigned long long getCount() const;
+    unsigned long long getSum() const;
+    // Both are 0 while the Histogram is empty
+    unsigned long long getMin() const;
+    unsigned long long getMax() const;
+    double getMean() const;
+    // The value percent% of values are at or below, give or take a bucket
+    unsigned long long getPercentile(double percent) const;
+    // How many values were at or below limit, which is exact when limit is
+    // one short of a power of two
+    unsigned long long countAtOrBelow(unsigned long long limit) const;
+
+};
+
+///////////////////////////////// OBJECT POOLS /////////////////////////////////
+
+/*
+ * A Pool owns objects of one type and hands out Handles to them, rather than
+ * pointers. The objects live in chunks of slots that never move, so making
+ * and destroying them reuses slots instead of going back to the heap, and
+ * forEach() visits them in the order they sit in memory. Each slot counts
+ * how many times it has been reused, and a Handle remembers the count it was
+ * made with, so a Handle to something destroyed gets NULL from get() rather
+ * than whatever took its slot.
+ *
+ * A Pool stores its objects in place, so it holds exactly T and nothing
+ * derived from it. A Pool<Panel> can't hold a Panel subclass.
+ */
+template <typename T>
+class Pool {
+
+public:
+    // A default Handle refers to nothing
+    struct Handle {
+        unsigned index;
+        unsigned generation;    // 0 is never handed out
+
+        Handle() : index(0), generation(0) {}
+        Handle(unsigned indexIn, unsigned generationIn) :
+            index(indexIn), generation(generationIn) {}
+
+        bool operator==(const Handle & other) const {
+            return index == other.index && generation == other.generation;
+        }
+        bool operator!=(const Handle & other) const { return !(*this == other); }
+    };
+
+private:
+    static const unsigned chunkSize = 32;
+    static const unsigned noSlot = ~0u;
+
+    struct Slot {
+        alignas(T) unsigned char storage[sizeof(T)];
+        unsigned generation;
+        unsigned nextFree;      // Only meaningful while the slot is free
+        bool live;
+    };
+
+    std::vector<Slot *> chunks;
+    unsigned freeList;          // First free slot, or noSlot
+    size_t count;
+
+    Slot & slotAt(unsigned index) { return chunks[index / chunkSize][index % chunkSize]; }
+    T * objectIn(Slot & slot) { return reinterpret_cast<T *>(slot.storage); }
+    // Add a chunk of free slots, which come out lowest first
+    void grow();
+
+public:
+    Pool();
+    ~Pool();
+    Pool(const Pool &) = delete;
+    Pool & operator=(const Pool &) = delete;
+
+    // Construct a T from args in a free slot
+    template <typename... Args>
+    Handle create(Args &&... args);
+    // Returns false if there was nothing there to destroy
+    bool destroy(Handle handle);
+    void clear();
+
+    // NULL if the Handle's object has been destroyed
+    T * get(Handle handle);
+    bool contains(Handle handle);
+    size_t size() const;
+
+    // Call function on every object in the Pool. It may destroy the object
+    // it's given, and anything it creates may or may not be visited.
+    template <typename Function>
+    void forEach(Function function);
+
+};
+
+template <typename T>
+Pool<T>::Pool() : freeList(noSlot), count(0) {}
+
+template <typename T>
+Pool<T>::~Pool() {
+    clear();
+    for(Slot * chunk : chunks) {
+        delete[] chunk;
+    }
+}
+
+template <typename T>
+void Pool<T>::grow() {
+    unsigned first = (unsigned)chunks.size() * chunkSize;
+    Slot * chunk = new Slot[chunkSize];
+    for(unsigned i = 0; i < chunkSize; i++) {
+        chunk[i].generation = 1;
+        chunk[i].live = false;
+        chunk[i].nextFree = (i + 1 < chunkSize) ? first + i + 1 : freeList;
+    }
+    chunks.push_back(chunk);
+    freeList = first;
+}
+
+template <typename T>
+template <typename... Args>
+typename Pool<T>::Handle Pool<T>::create(Args &&... args) {
+    if(freeList == noSlot) {
+        grow();
+    }
+
+    // The slot stays free until the constructor has finished without throwing
+    unsigned index = freeList;
+    Slot & slot = slotAt(index);
+    new (slot.storage) T(std::forward<Args>(args)...);
+    freeList = slot.nextFree;
+    slot.live = true;
+    count++;
+    return Handle(index, slot.generation);
+}
+
+template <typename T>
+bool Pool<T>::destroy(Handle handle) {
+    if(!contains(handle)) { return false; }
+
+    // Marked dead first, in case the destructor finds its way back here
+    Slot & slot = slotAt(handle.index);
+    slot.live = false;
+    objectIn(slot)->~T();
+
+    if(++slot.generation == 0) {
+        slot.generation = 1;
+    }
+    slot.nextFree = freeList;
+    freeList = handle.index;
+    count--;
+    return true;
+}
+
+template <typename T>
+void Pool<T>::clear() {
+    for(unsigned index = 0; index < chunks.size() * chunkSize; index++) {
+        Slot & slot = slotAt(index);
+        if(slot.live) {
+            destroy(Handle(index, slot.generation));
+        }
+    }
+}
+
+template <typename T>
+T * Pool<T>::get(Handle handle) {
+    return contains(handle) ? objectIn(slotAt(handle.index)) : NULL;
+}
+
+template <typename T>
+bool Pool<T>::contains(Handle handle) {
+    if(handle.generation == 0 || handle.index >= chunks.size() * chunkSize) {
+        return false;
+    }
+    Slot & slot = slotAt(handle.index);
+    return slot.live && slot.generation == handle.generation;
+}
+
+template <typename T>
+size_t Pool<T>::size() const {
+    return count;
+}
+
+template <typename T>
+template <typename Function>
+void Pool<T>::forEach(Function function) {
+    for(unsigned index = 0; index < chunks.size() * chunkSize; index++) {
+        Slot & slot = slotAt(index);
+        if(slot.live) {
+            function(*objectIn(slot));
+        }
+    }
+}
+
 /////////////////////////////// BASE CLASSES /////////////////////////////////
 
+/*
+ * EngineSettings hold the choices that have to be made before curses starts
+ * up, so they're handed to the Engine's constructor. Anything left at its
+ * default can also be set from the environment, as noted for each setting.
+ */
+struct EngineSettings {
+
+    // Tee everything written to the terminal, with timestamps, into an
+    // asciicast v2 file (VEXES_CAPTURE). Empty means no capture.
+    std::string capturePath;
+
+    /*
+     * Which backend sends frames to the terminal (VEXES_BACKEND=direct).
+     * The curses backend leaves it to doupdate(). The direct backend diffs
+     * each frame against the last one itself, picks the shortest cursor
+     * moves and attribute changes, and writes the whole frame with a single
+     * writev(). Drawing works the same either way. The direct backend needs
+     * an ANSI terminal, and falls back to curses on anything else.
+     */
+    enum Backend {CURSES_BACKEND, DIRECT_BACKEND};
+    Backend backend = CURSES_BACKEND;
+
+    /*
+     * Wrap each frame in DEC mode 2026 (synchronized output), so terminals
+     * draw it all at once instead of tearing halfway through a big update
+     * (VEXES_SYNC=on|off). SYNC_AUTO uses it when terminfo has the Sync
+     * capability, or when the terminal says it's supported when asked at
+     * startup. Terminals without it never see the sequences.
+     */
+    enum SyncMode {SYNC_AUTO, SYNC_ON, SYNC_OFF};
+    SyncMode synchronizedOutput = SYNC_AUTO;
+
+    /*
+     * Watch for output backing up on a slow link, and space frames out
+     * when it does, skipping the ones in between. Keys are always read
+     * ahead of frames, and the rate recovers once the link drains
+     * (VEXES_ADAPTIVE=off to turn it off).
+     */
+    bool adaptiveFrameRate = true;
+
+    /*
+     * Tune everything for a poor remote link (VEXES_LOW_BANDWIDTH=on).
+     * Frames are capped at lowBandwidthFrameRate, so small updates pile up
+     * into one larger frame. Colours are brought down to the basic eight,
+     * curses is allowed to move content with line insert and delete, and
+     * Engine::animationsEnabled() turns false. Panels can ask for
+     * Engine::getFrameByteBudget() to decide how much detail to draw.
+     */
+    bool lowBandwidth = false;
+    int lowBandwidthFrameRate = 10;
+    int lowBandwidthBytesPerSecond = 4000;
+
+    /*
+     * How often getInput() gives up waiting and returns ERR when nothing
+     * has happened, in milliseconds (VEXES_TICK). The default of 0 never
+     * does: the Engine sleeps until a key, a timer, an animation frame, an
+     * invalidated Panel or a watched file descriptor needs it, and uses no
+     * CPU at all while idle. Apps that redraw on every tick instead can set
+     * it to something like 50.
+     */
+    int tickInterval = 0;
+
+    // Frames per second while any animation is running
+    int animationFrameRate = 30;
+
+    /*
+     * Time every frame, from getInput() returning until the frame has gone
+     * out, and report any that take longer than frameBudget milliseconds
+     * (VEXES_FRAME_BUDGET, 0 for off). Each report says how long each Panel
+     * that was drawn, each timer, handling the key and presenting the frame
+     * took, as one line of JSON appended to frameReportPath
+     * (VEXES_FRAME_REPORT). At most one report is written every
+     * frameReportInterval milliseconds; slow frames in between are counted
+     * in the next one, so logging can't make a slow stretch any slower.
+     */
+    int frameBudget = 0;
+    std::string frameReportPath = "vexes-frames.log";
+    int frameReportInterval = 1000;
+
+    /*
+     * Keep Histograms of how long each frame takes, how long it is from a
+     * key arriving until the first output answering it is sent, how long
+     * each Panel takes to draw, and how many bytes each flush sends
+     * (VEXES_METRICS=on). Times are in microseconds. Setting metricsSocket
+     * (VEXES_METRICS_SOCKET) turns them on too, and listens on a Unix socket
+     * there: anything that connects is sent the lot in Prometheus text
+     * format, so a local scraper can collect it with something like
+     * socat - UNIX-CONNECT:path.
+     */
+    bool metrics = false;
+    std::string metricsSocket;
+
+    // How long a hidden Panel keeps its window before letting it go, in
+    // milliseconds. getInput() wakes up to let it go, like it does for a
+    // timer.
+    int hiddenWindowTimeout = 5000;
+
+};
+
+class Panel;
+class Form;
+
 /*
  * The Engine class is a basic wrapper for initializing and running an ncurses
  * application. The user creates a subclass of the Engine and defines an
@@ -149,10 +552,37 @@ protected:
     void setupCursesEnvironment();
     // Make sure to clean up after ourselves
     void teardownCursesEnvironment();
+    // Fill in any settings left at their defaults from the environment
+    void readEnvironmentSettings();
+    // Hand frames over to the direct backend, if the terminal allows it
+    void setupDirectOutput();
+    // Decide whether frames are wrapped in synchronized updates
+    void setupSynchronizedOutput();
+    // Apply the low bandwidth settings to curses and the color pairs
+    void setupLowBandwidth();
+    // Set up modes, colors and output for the selected terminal
+    void setupTerminal();
+    // Undo setupTerminal() and leave curses mode on the selected terminal
+    void teardownTerminal();
+    // Turn on mouse reporting for the selected terminal
+    void setupMouse();
+
+    EngineSettings settings;
+    bool mouseEnabled;
+
+    // Panels and Forms made here belong to the Engine, and are destroyed
+    // before curses is torn down. These only make plain Panels and Forms.
+    // An app with its own Panel or Form subclasses has to keep its own
+    // Pools for them, such as a Pool<MyPanel> member of its Engine
+    // subclass. Members of the subclass are destroyed before ~Engine()
+    // runs, so they're gone before curses is torn down too.
+    Pool<Panel> panelPool;
+    Pool<Form> formPool;
 
 public:
     // Setup curses when the Engine is created
     Engine();
+    Engine(EngineSettings settingsIn);
     // Teardown curses when the Engine is destroyed
     virtual ~Engine();
 
@@ -167,6 +597,135 @@ public:
      */
     virtual void run() = 0;
 
+    // Start reporting mouse presses, releases and drags through getch()
+    void enableMouse();
+
+    /*
+     * Send everything drawn since the last frame to the terminal. getInput()
+     * does this before waiting for a key, so it's only needed when drawing
+     * outside the usual draw-then-read loop. Panels only ever add to the
+     * frame, so use this rather than refresh() or doupdate(), on either
+     * backend. On a congested link the frame may be held back, and
+     * getInput() sends it once it can.
+     */
+    void flushFrame();
+    // The backend in use on the selected terminal, which may have fallen
+    // back from the one asked for
+    EngineSettings::Backend getBackend();
+    // Whether the selected terminal's frames are wrapped in synchronized
+    // updates
+    bool hasSynchronizedOutput();
+    // Milliseconds the Engine is currently leaving between frames on the
+    // selected terminal because of a slow link, or 0 when it's keeping up
+    int getFrameInterval();
+
+    /*
+     * One Engine can drive more than one terminal, like the pty of a
+     * terminal on a second monitor. Give openTerminal() the path of its tty,
+     * and optionally its type ($TERM by default). It gets the same settings,
+     * colors and mouse setup as the first one, but its own SCREEN, backend
+     * and frame pacing, so a slow terminal never holds up the others.
+     * Returns the new terminal's number, or -1 if it couldn't be opened.
+     * Terminal 0 is the one the app started in.
+     *
+     * Panels, layouts and drawing utilities work on the selected terminal.
+     * Panels stay on whichever terminal was selected when they were made,
+     * so they can be drawn and resized from anywhere. getInput() waits on
+     * every open terminal at once and sends each its own frames.
+     *
+     * Delete a terminal's Panels before closing it. Recording, replay and
+     * capture only follow terminal 0.
+     */
+    int openTerminal(std::string path, std::string type = "");
+    void closeTerminal(int index);
+    void selectTerminal(int index);
+    static int getSelectedTerminal();
+
+    // These can be asked from anywhere, like a Panel's drawPanel()
+    static bool isLowBandwidth();
+    // Whether purely cosmetic animations are worth drawing
+    static bool animationsEnabled();
+    // Roughly how many bytes a frame should cost on a slow link, or 0 when
+    // there's no limit
+    static int getFrameByteBudget();
+
+    /*
+     * Timers call back after the given number of milliseconds, and again
+     * every interval after that if repeat is set. getInput() runs them when
+     * they're due, then returns (with ERR, unless a key came in too) so the
+     * app's loop can redraw. The name shows up in frame budget reports.
+     * Returns an id for removeTimer().
+     */
+    static int addTimer(int milliseconds, std::function<void()> callback, bool repeat = false,
+                        std::string name = "");
+    static void removeTimer(int id);
+
+    // Charge everything since the last Panel was drawn (or the frame began)
+    // to name in frame budget reports. Call it once a key has been handled,
+    // or that time is charged to the first Panel drawn after, in reports
+    // and in Panel draw time metrics alike.
+    static void chargeFrameTime(const std::string & name);
+
+    /*
+     * The metrics kept when EngineSettings::metrics is on, which stay empty
+     * otherwise. Panels are told apart by title, and getPanelDrawTimes()
+     * returns NULL for one that hasn't been drawn. Flush bytes are only
+     * counted on the direct backend. Input latency runs from a key coming in
+     * to the frame drawn for it going out.
+     */
+    static const Histogram & getFrameTimes();
+    static const Histogram & getInputLatencies();
+    static const Histogram & getFlushBytes();
+    static const Histogram * getPanelDrawTimes(const std::string & title);
+    static void resetMetrics();
+    // All of the above in Prometheus text format
+    static std::string formatMetrics();
+    // Write formatMetrics() to path, replacing the file in one go so a
+    // scraper never reads half of it. Returns false if it couldn't.
+    static bool dumpMetrics(const std::string & path);
+
+    // Roughly how many bytes every Panel and Form holds, going by their
+    // getMemoryUsage(), plus the screens and buffers kept for each terminal
+    static size_t getMemoryUsage();
+
+    // Draw every Panel that has been invalidated and isn't hidden, lowest
+    // z-order first, and Panels made earlier before later ones. Which ones
+    // need it is worked out from packed data the Engine keeps on each Panel,
+    // before any of them is called. Returns how many were drawn. Their
+    // drawPanel() shouldn't make or delete Panels.
+    static int drawInvalidatedPanels();
+
+    // While any animation is running, getInput() returns at least once a
+    // frame so it can be drawn. Each beginAnimation() needs an endAnimation().
+    static void beginAnimation();
+    static void endAnimation();
+
+    // Have getInput() return ERR once fd has something to read, like a
+    // socket the app gets its updates from. Read it, or getInput() will keep
+    // returning. With a callback, that's called instead, and getInput() only
+    // returns if it says to. Callbacks can watch and unwatch fds, their own
+    // included, which takes effect once they've all been called.
+    static void watchFd(int fd, std::function<bool()> callback = nullptr);
+    static void unwatchFd(int fd);
+
+    /*
+     * Every key read with getInput() can be recorded to a compact binary log
+     * along with when it arrived, and played back later. Replaying in real
+     * time reproduces a session exactly, while replaying as fast as possible
+     * turns it into a repeatable benchmark. Once a replay runs out of input,
+     * getInput() goes back to reading the keyboard.
+     *
+     * Both can also be turned on without code changes, by setting
+     * VEXES_RECORD or VEXES_REPLAY to a log path before starting the app.
+     * Set VEXES_REPLAY_FAST to replay as fast as possible.
+     *
+     * These return false if the log file could not be opened.
+     */
+    bool recordInput(std::string path);
+    bool replayInput(std::string path, bool realTime = true);
+    // Stop any recording (flushing the log) or replay
+    void stopInputLog();
+
 };
 
 /*
@@ -175,6 +734,14 @@ public:
  * the terminal screen as a whole and it will handle sizing and resizing for
  * you! When users subclass this base class, they have the option of making
  * their own drawPanel() function, but the default is provided out of the box.
+ *
+ * A Panel can also be made inside another one, for nested dashboards. Its
+ * window is then a view into the parent's, sharing its cells instead of
+ * having its own, and drawing it doesn't refresh anything by itself: the
+ * parent's window is refreshed once for all the Panels inside it, when the
+ * frame goes out. The parent should be drawn before the Panels inside it,
+ * since they draw over the same cells. A Panel that doesn't fit inside its
+ * parent, or whose parent is hidden or gone, gets a window of its own.
  */
 class Panel {
 
@@ -183,11 +750,24 @@ protected:
     std::string title;
     Box globalDimensions;   // globalDimensions is in relation to stdscr
     Box localDimensions;    // localDimensions is in relation to win
+    Point windowOrigin;     // Upper left of win in relation to stdscr
+    SCREEN * screen;        // The terminal the Panel was made on
     int lines, columns;
-
-    // Create new internal window based on global position
+    bool externalBorder;    // Border is drawn by someone else (compositor)
+    size_t registryIndex;   // Where the Engine keeps what each frame asks about
+    bool hidden;
+    bool ownsWindow;        // Otherwise win is the terminal's placeholder
+    bool derived;           // win is a view into the parent's window
+    Panel * parent;
+    std::vector<Panel *> children;
+
+    // Work out sizes, local dimensions and window origin from a global Box
+    void calculateDimensions(Box newGlobalDimensions);
+    // Create new internal window based on global position, unless the Panel
+    // is hidden or there's no room for it
     void setupWindow();
-    // Safely destroy internal window
+    // Safely destroy internal window, leaving the placeholder in its place.
+    // Views into it from the Panels inside go first.
     void teardownWindow();
     // Default draws a box around the window
     void drawBorder();
@@ -197,12 +777,17 @@ protected:
     void refreshWindow();
     // Destroy old window, make a new one
     void replaceWindow();
+    // Resize and move the existing window, falling back to replaceWindow()
+    void resizeWindow();
     // Clear the space of the internal window
     void clearScreen();
 
 public:
-    // Title string is optional
-    Panel(Box globalDimensionsIn, std::string titleIn = "");
+    // Title string is optional. A Panel made hidden doesn't make a window
+    // until it's shown.
+    Panel(Box globalDimensionsIn, std::string titleIn = "", bool hiddenIn = false);
+    // Made inside parentIn, which has to outlive it or let it go first
+    Panel(Panel * parentIn, Box globalDimensionsIn, std::string titleIn = "");
     // Clean up after ourselves
     virtual ~Panel();
 
@@ -213,8 +798,67 @@ public:
     void resizePanel(Box newGlobalDimensions);
 
     WINDOW * getWin();
+    // NULL unless the Panel was made inside another
+    Panel * getParent();
 
     void setTitle(std::string newTitle);
+    const std::string & getTitle();
+
+    Box getDimensions();
+
+    // Let something else (like a BorderCompositor) own the border, shrinking
+    // the window down to just the space inside it
+    void setExternalBorder(bool external);
+
+    // Ask for the Panel to be drawn again, from a timer for example.
+    // getInput() won't go to sleep until it has been refreshed, unless it's
+    // reading some other window than stdscr, like a Form being edited.
+    void invalidate();
+    bool isInvalidated();
+
+    // Panels with a higher z-order are drawn later by drawInvalidatedPanels(),
+    // so they end up on top. It's 0 to begin with.
+    void setZOrder(int z);
+    int getZOrder();
+
+    /*
+     * Scroll everything inside the border up by n lines (or down, if n is
+     * negative), leaving n blank lines to draw the new content into. When
+     * the Panel spans the full width of a terminal with scroll regions, the
+     * terminal does the moving, so a frame only has to carry the new lines.
+     * Otherwise the moved lines are redrawn as usual. Returns whether the
+     * terminal will do the scrolling.
+     */
+    bool scrollContent(int n);
+
+    /*
+     * Panels on a tab that isn't showing, or in a layout that isn't active,
+     * can be hidden, along with any Panels inside them. A hidden Panel is
+     * never put on the screen, and invalidating it doesn't keep getInput()
+     * awake. Once it has been hidden for EngineSettings::hiddenWindowTimeout,
+     * it's told to releaseCaches(), and lets go of its window, even if no
+     * key comes in meanwhile. Showing it again makes a new one and
+     * invalidates the Panel, so the app draws it afresh.
+     *
+     * Until a Panel has a window of its own (while hidden, or when it has
+     * no room on the screen), win is a tiny placeholder that clips away
+     * anything drawn on it, so drawing code doesn't need to check.
+     */
+    void hide();
+    void show();
+    bool isHidden();
+    bool hasWindow();
+
+    /*
+     * Roughly how many bytes the Panel holds: the cells of its window, its
+     * title, and the Panel itself. Subclasses that keep content or caches
+     * of their own should add them on. When memory is short, the app can
+     * have Panels that are off screen releaseCaches(), letting go of
+     * anything they can rebuild when they're next drawn. A hidden Panel
+     * lets go of its window, so overrides should call this one too.
+     */
+    virtual size_t getMemoryUsage();
+    virtual void releaseCaches();
 
 };
 
@@ -234,6 +878,7 @@ protected:
     int promptLength;
     std::string buffer;
     WINDOW * win;
+    SCREEN * screen;    // The terminal the Form was made on
     int lines, columns;
 
     // Remove buffer remnants in case user deletes input characters
@@ -267,9 +912,15 @@ public:
     virtual void drawForm();
     // Adds an arbitrary string to the internal buffer, one char at a time
     void injectString(std::string str);
-    // Enters an internal loop where user can fill out the form
+    // Enters an internal loop where user can fill out the form. Keys are
+    // read from the terminal the Form was made on.
     virtual std::string edit();
 
+    WINDOW * getWin();
+
+    // Roughly how many bytes the Form holds, window and buffers included
+    virtual size_t getMemoryUsage();
+
 };
 
 ///////////////////////////// LAYOUT UTILITIES ///////////////////////////////
@@ -300,15 +951,15 @@ class Layouts {
 
 private:
     // This function is used to see if the numbers in ratio strings are ints
-    static bool isInteger(const std::string & s) {
-       if(s.empty() || ((!isdigit(s[0])) && (s[0] != '-') && (s[0] != '+'))) {
+    static bool isInteger(const char * s, size_t length) {
+       if(length == 0 || ((!isdigit(s[0])) && (s[0] != '-') && (s[0] != '+'))) {
            return false;
        }
 
        char * p;
-       strtol(s.c_str(), &p, 10);
+       strtol(s, &p, 10);
 
-       return (*p == 0);
+       return (p == s + length);
     }
 
     /*
@@ -317,7 +968,7 @@ private:
      * Colons cannot appear more than once in a row (so "1::1:2" is not valid)
      * and cannot appear on either end of the string (":1:1:2" isn't valid).
      */
-    static void validateRatio(std::string ratio) {
+    static void validateRatio(const std::string & ratio) {
         // Check for at least one colon
         if(ratio.find(':') == std::string::npos) {
             const char * message = "Ratios must contain at least one colon.";
@@ -342,20 +993,21 @@ private:
         }
 
         // Split string on colons and check for integers
-        std::stringstream ss(ratio);
-        std::string token;
-        while(std::getline(ss, token, ':')) {
+        for(size_t start = 0; start < ratio.size(); ) {
+            size_t end = std::min(ratio.find(':', start), ratio.size());
+
             // Check if token is integer
-            if(!isInteger(token)) {
+            if(!isInteger(ratio.c_str() + start, end - start)) {
                 const char * message = "Ratios can only contain valid integers.";
                 throw InvalidRatioException(message);
             }
             // Integer cannot be 0
-            int num = std::stoi(token);
-            if(num == 0) {
+            if(strtol(ratio.c_str() + start, NULL, 10) == 0) {
                 const char * message = "Ratios cannot contain 0 as an integer.";
                 throw InvalidRatioException(message);
             }
+
+            start = end + 1;
         }
 
         // If all the above checks out, ratio is valid
@@ -363,13 +1015,15 @@ private:
     }
 
     // Split the ratio string on colons and cast numbers to ints.
-    static std::vector<int> extractNumsFromString(std::string ratio) {
+    static std::vector<int> extractNumsFromString(const std::string & ratio) {
         std::vector<int> nums;
-        std::stringstream ss(ratio);
-        std::string token;
-        while(std::getline(ss, token, ':')) {
-            int num = std::stoi(token);
-            nums.push_back(num);
+        nums.reserve(std::count(ratio.begin(), ratio.end(), ':') + 1);
+
+        const char * p = ratio.c_str();
+        while(*p != '\0') {
+            char * end;
+            nums.push_back((int)strtol(p, &end, 10));
+            p = (*end == ':') ? end + 1 : end;
         }
 
         return nums;
@@ -380,7 +1034,7 @@ private:
      * resulting in a set of distinct Boxes that take up the proper space
      * and positions desired.
      */
-    static std::vector<Box> calculateHBoxes(std::vector<int> nums, Box * dimensions) {
+    static std::vector<Box> calculateHBoxes(const std::vector<int> & nums, Box * dimensions) {
         // Get an overall ratio base
         int base = 0;
         for(int num : nums) {
@@ -388,6 +1042,7 @@ private:
         }
 
         std::vector<Box> boxes;
+        boxes.reserve(nums.size());
 
         // Initialize dimensions based on dimensions (stdscr by default)
         int fullWidth, fullHeight;
@@ -413,9 +1068,9 @@ private:
             float frac = (float) num / base;
             int columns = (int) (frac * fullWidth);
 
-            // Truncate columns if they would go offscreen
-            if(lastX + 1 + columns >= fullWidth) {
-                columns = fullWidth - (lastX + 1);
+            // Truncate columns if they would go past the right edge
+            if(lastX + 1 + columns >= startX + fullWidth) {
+                columns = startX + fullWidth - (lastX + 1);
             }
 
             // Turn those rows and columns into Box dimensions
@@ -433,7 +1088,7 @@ private:
     }
 
     // Similar to calculateHBoxes, but for vertical layouts.
-    static std::vector<Box> calculateVBoxes(std::vector<int> nums, Box * dimensions) {
+    static std::vector<Box> calculateVBoxes(const std::vector<int> & nums, Box * dimensions) {
         // Get an overall ratio base
         int base = 0;
         for(int num : nums) {
@@ -441,6 +1096,7 @@ private:
         }
 
         std::vector<Box> boxes;
+        boxes.reserve(nums.size());
 
         // Initialize dimensions based on dimensions (stdscr by default)
         int fullWidth, fullHeight;
@@ -466,9 +1122,9 @@ private:
             int rows = (int) (frac * fullHeight);
             int columns = fullWidth;
 
-            // Truncate rows if they would go offscreen
-            if(lastY + 1 + rows >= fullHeight) {
-                rows = fullHeight - (lastY + 1);
+            // Truncate rows if they would go past the bottom edge
+            if(lastY + 1 + rows >= startY + fullHeight) {
+                rows = startY + fullHeight - (lastY + 1);
             }
 
             // Turn those rows and columns into Box dimensions
@@ -498,7 +1154,7 @@ public:
      * will not run, and the terminal may become stuck in curses mode upon
      * a runtime error.
      */
-    static std::vector<Box> customHLayout(std::string ratio, Box * dimensions = NULL) {
+    static std::vector<Box> customHLayout(const std::string & ratio, Box * dimensions = NULL) {
         std::vector<Box> boxes;
         // Check for proper ratio string
         try {
@@ -520,7 +1176,7 @@ public:
      * This is similar to customHLayout(), but for vertical layouts. The user
      * is still responsible for catching InvalidRatioExceptions.
      */
-    static std::vector<Box> customVLayout(std::string ratio, Box * dimensions = NULL) {
+    static std::vector<Box> customVLayout(const std::string & ratio, Box * dimensions = NULL) {
         std::vector<Box> boxes;
         // Check for proper ratio string
         try {
@@ -538,6 +1194,29 @@ public:
         return boxes;
     }
 
+    /*
+     * Validate a ratio string and hand back its numbers. This lets callers
+     * that lay out the same ratio over and over (like the LayoutTree) parse
+     * it once and keep the numbers around.
+     */
+    static std::vector<int> parseRatio(const std::string & ratio) {
+        try {
+            validateRatio(ratio);
+        } catch(InvalidRatioException& e) {
+            throw InvalidRatioException(e.what());
+        }
+
+        return extractNumsFromString(ratio);
+    }
+
+    // Same as the string versions, but with pre-parsed ratio numbers
+    static std::vector<Box> customHLayout(const std::vector<int> & nums, Box * dimensions = NULL) {
+        return calculateHBoxes(nums, dimensions);
+    }
+    static std::vector<Box> customVLayout(const std::vector<int> & nums, Box * dimensions = NULL) {
+        return calculateVBoxes(nums, dimensions);
+    }
+
     /*
      * What follows are a bunch of default layouts in both orientations. Since
      * these functions will use valid ratio strings, there is no need to catch
@@ -569,3 +1248,405 @@ public:
     }
 
 };
+
+/*
+ * The LayoutTree is a longer-lived version of the Layouts utilities. Rather
+ * than handing back a vector of Boxes for the user to pair up with Panels by
+ * hand, it remembers every split (and nested split) along with the Panels
+ * that live in them. Since it knows where every split border is, it can let
+ * the user drag those borders around with the mouse, re-laying out only the
+ * two slots on either side of the border that moved.
+ *
+ * Splits are referred to by index, with the root split always being 0. Each
+ * split has one slot per number in its ratio, and each slot holds either a
+ * Panel or another split.
+ */
+class LayoutTree {
+
+public:
+    enum Orientation { HORIZONTAL, VERTICAL };
+
+    // A slot holding a Panel (or nothing) rather than another split
+    struct Leaf {
+        Box bounds;
+        Panel * panel;
+    };
+
+protected:
+    // Slots can never be dragged smaller than this many cells
+    static const int minimumSlotSize = 3;
+
+    struct Slot {
+        int weight;
+        int minimum;    // Smallest size in cells, or 0 for no constraint
+        int child;      // Index of a nested split, or -1
+        Panel * panel;  // Panel occupying this slot, or NULL
+        Box bounds;
+    };
+
+    struct Split {
+        Orientation orientation;
+        std::vector<Slot> slots;
+        Box bounds;
+    };
+
+    std::vector<Split> splits;
+    std::vector<Panel *> panels;    // Reused by getPanels() and getLeaves()
+    std::vector<Leaf> leaves;
+    bool hasDimensions;
+    Box dimensions;
+    bool sharedBorders;     // Neighbouring slots overlap by one cell
+    int generation;         // Bumped every time any bounds change
+
+    // Drags are tracked by split index and the border after slot 'border'
+    bool dragging;
+    bool dragPending;
+    int dragSplit, dragBorder;
+    Point dragPoint;
+
+    // Recursively calculate bounds for a split and everything inside it
+    void layoutSplit(int index, Box bounds);
+    // Grow slots that are under their minimum by shrinking their siblings
+    void applyMinimums(Split & split, std::vector<Box> & boxes, Box bounds);
+    // Set a slot's bounds, resizing its Panel or laying out its split
+    void layoutSlot(Slot & slot, Box bounds);
+    // Find the split border under a point, if there is one
+    bool findBorder(Point p, int & split, int & border);
+    // Move the border being dragged to the last reported mouse position
+    bool applyDrag();
+
+public:
+    // The root split is created along with the tree
+    LayoutTree(Orientation orientation, std::string ratio);
+
+    // Turn a slot of an existing split into a new split, returning its index
+    int addSplit(int split, int slot, Orientation orientation, std::string ratio);
+    // Place a Panel in a slot of an existing split
+    void attachPanel(int split, int slot, Panel * panel);
+    // Keep a slot at least this many cells big, when there's room for it
+    void setMinimumSize(int split, int slot, int minimum);
+
+    // Take on the splits and Panels of another tree, then lay out again.
+    // Only Panels whose bounds actually changed are resized.
+    void replace(const LayoutTree & other);
+
+    // Lay out the whole tree, within the given Box or stdscr by default
+    void layout(Box * dimensionsIn = NULL);
+
+    // Feed mouse events to the tree, returns true if it used the event
+    bool handleMouse(const MEVENT & event);
+    // Apply at most one pending drag, returns true if anything moved
+    // Call this once per frame, no matter how many mouse events came in
+    bool update();
+
+    // Both are refilled on every call, so they're only good until the next
+    const std::vector<Panel *> & getPanels();
+    const std::vector<Leaf> & getLeaves();
+
+    // Make neighbouring slots share their border row/column. Panels in the
+    // tree stop drawing their own borders, so something like the
+    // BorderCompositor needs to draw them instead.
+    void setSharedBorders(bool shared);
+    bool hasSharedBorders();
+
+    // Changes whenever the layout does, so callers can cache against it
+    int getGeneration();
+
+};
+
+/*
+ * The BorderCompositor draws the borders for every Panel in a LayoutTree,
+ * instead of each Panel drawing its own box. Since it knows the layout, it
+ * draws each shared edge only once and joins them up with proper tee and
+ * cross characters. It also only redraws the borders when the layout (or a
+ * title) has changed, which means less output every frame.
+ *
+ * Creating a compositor puts the tree into shared border mode, so Panels
+ * each gain a row and column of content space per split.
+ */
+class BorderCompositor {
+
+protected:
+    // Which directions a border cell connects in
+    enum Edge { NORTH = 1, SOUTH = 2, WEST = 4, EAST = 8 };
+
+    LayoutTree * layout;
+    int drawnGeneration;
+    std::vector<std::string> drawnTitles;
+
+    int drawnThemeGeneration;
+
+    // One entry per stdscr cell, holding that cell's Edge bits
+    std::vector<unsigned char> edges;
+    std::vector<int> borderCells;   // Indexes into edges that are non-zero
+    int edgeColumns, edgeLines;
+
+    // Add the Edge bits for the outline of a Box
+    void markBox(Box b);
+    void markCell(int x, int y, unsigned char bits);
+    // Pick the line drawing character for a set of Edge bits
+    chtype glyphForEdges(unsigned char bits);
+    // Check the Panel titles against what we last drew
+    bool titlesChanged(const std::vector<LayoutTree::Leaf> & leaves);
+
+public:
+    BorderCompositor(LayoutTree * layoutIn);
+    ~BorderCompositor();
+
+    // Draw the borders to stdscr if anything has changed since last time,
+    // returning true if they were drawn. Call this before drawing Panels.
+    bool draw(bool force = false);
+
+};
+
+/*
+ * The ResponsiveLayout picks between several LayoutTrees depending on how big
+ * the terminal is, so an app can have one layout for a laptop terminal and
+ * another for a huge monitor. Every tree is built up front, and the same
+ * Panels can be attached to as many of them as you like; switching layouts
+ * just resizes the Panels instead of destroying and recreating them.
+ *
+ * A breakpoint applies when the terminal is at least minColumns wide and
+ * minLines tall. If more than one applies, the one added last wins, so add
+ * them from smallest to largest. If none apply, the first one is used. A
+ * negative minimum is taken as 0.
+ */
+class ResponsiveLayout {
+
+protected:
+    struct Breakpoint {
+        int minColumns, minLines;
+        LayoutTree * layout;
+    };
+
+    std::vector<Breakpoint> breakpoints;
+    int active;
+
+    // Lookup tables rebuilt whenever a breakpoint is added, so that picking
+    // a layout on resize is a couple of array lookups instead of a search
+    std::vector<int> columnThresholds, lineThresholds;
+    std::vector<int> columnClass, lineClass;   // Size -> threshold class
+    std::vector<int> classTable;               // Class pair -> breakpoint
+
+    void compile();
+    // Find which breakpoint applies to a terminal size
+    int lookup(int columns, int lines);
+
+public:
+    ResponsiveLayout();
+
+    // The ResponsiveLayout does not take ownership of the tree
+    void addBreakpoint(int minColumns, int minLines, LayoutTree * layout);
+
+    // Pick and lay out the right tree for the current terminal size. Call
+    // this once at startup and again after every KEY_RESIZE. Returns true
+    // if the active layout changed. Panels only found in the other layouts
+    // are hidden, and the active layout's are shown.
+    bool resize();
+
+    LayoutTree * getActive();
+    // Only the active layout's Panels should be drawn
+    const std::vector<Panel *> & getActivePanels();
+
+};
+
+/*
+ * Custom exception for denoting invalid layout files. Unlike ratio strings,
+ * layout files can be wrong in lots of places, so the message includes the
+ * line number.
+ */
+struct InvalidLayoutException : public std::exception {
+
+private:
+    std::string message;
+
+public:
+    InvalidLayoutException(std::string messageIn) : message(messageIn) {}
+    const char * what() const throw () {
+        return message.c_str();
+    }
+
+};
+
+/*
+ * The FileWatcher uses inotify to find out when a file has been written to,
+ * without polling the filesystem. It watches the file's directory rather
+ * than the file itself, since a lot of editors save by writing a new file
+ * and renaming it over the old one.
+ */
+class FileWatcher {
+
+protected:
+    int fd;
+    int watch;
+    std::string directory;
+    std::string filename;
+    bool pending;           // Seen while draining for getInput()
+
+    // Read every queued event, returning true if any were for our file
+    bool drain();
+
+public:
+    FileWatcher(std::string path);
+    ~FileWatcher();
+
+    // Never blocks, returns true if the file changed since the last call
+    bool changed();
+
+    // Can be handed to poll() to wait for changes
+    int getFd();
+
+};
+
+/*
+ * The LayoutFile loads a LayoutTree from a small text file, and reloads it
+ * whenever the file changes. Each line is a split or a Panel, and nesting is
+ * done with indentation:
+ *
+ *     # Comments start with a hash
+ *     hsplit 1:1:2
+ *         panel sidebar "Small Panel" min=20
+ *         vsplit 1:1:1
+ *             panel inner1 "Inner Panel 1"
+ *             panel inner2 "Inner Panel 2"
+ *             panel inner3 "Inner Panel 3"
+ *         panel main "Large Panel"
+ *
+ * Every split needs exactly one child per number in its ratio, and each
+ * Panel name can only appear once. Titles and min=N (the smallest size in
+ * cells, a whole number) are optional on any line.
+ *
+ * Panels are looked up by name. Register your own Panels (and subclasses)
+ * with registerPanel() before calling load(); any other name gets a default
+ * Panel, which the LayoutFile owns. Those are only made once the whole file
+ * turns out to be valid. Panels are kept around between reloads,
+ * so only the ones whose bounds changed get resized.
+ */
+class LayoutFile {
+
+protected:
+    std::string path;
+    LayoutTree * layout;
+    FileWatcher * watcher;
+    std::map<std::string, Panel *> panels;
+    std::vector<Panel *> ownedPanels;
+    std::string lastError;
+
+    // Parse the whole file into a new tree, throwing on any mistake
+    LayoutTree * parse();
+    Panel * findOrCreatePanel(const std::string & name);
+
+public:
+    LayoutFile(std::string pathIn);
+    ~LayoutFile();
+
+    // The LayoutFile does not take ownership of registered Panels
+    void registerPanel(std::string name, Panel * panel);
+
+    // Load the file for the first time, and start watching it for changes.
+    // The user is responsible for catching InvalidLayoutExceptions.
+    void load();
+    // Reload the layout if the file has changed, returning true if it did.
+    // If the new file is invalid, the old layout is kept and getError() says
+    // what went wrong.
+    bool poll();
+
+    LayoutTree * getLayout();
+    Panel * getPanel(std::string name);
+    const std::string & getError();
+
+};
+
+////////////////////////////////// THEMES ///////////////////////////////////
+
+/*
+ * Custom exception for denoting invalid theme files
+ */
+struct InvalidThemeException : public std::exception {
+
+private:
+    std::string message;
+
+public:
+    InvalidThemeException(std::string messageIn) : message(messageIn) {}
+    const char * what() const throw () {
+        return message.c_str();
+    }
+
+};
+
+/*
+ * The Theme maps semantic roles (like "title" or "error") to attributes and
+ * colors, loaded from a theme file like this:
+ *
+ *     # role = attributes and colors, with an optional "on" background
+ *     title     = bold yellow
+ *     border    = cyan
+ *     selection = reverse bold
+ *     error     = bold white on red
+ *
+ * Colors can be any of the usual eight names, "default", or a number for
+ * terminals with more colors. Everything is resolved when the file is
+ * loaded, including allocating color pairs, so drawing code just asks for
+ * the attribute of a style handle, which is a plain array lookup. Handles
+ * never change, so reloading the theme recolors the app without any
+ * changes to drawing code.
+ *
+ * The built-in roles always have the same handles. Other roles can be
+ * registered with getStyle(), once, and the handle kept around.
+ */
+class Theme {
+
+public:
+    enum Role { NORMAL, TITLE, BORDER, SELECTION, ERROR };
+
+protected:
+    static Theme * active;
+
+    std::string path;
+    FileWatcher * watcher;
+    std::string lastError;
+    int generation;
+
+    std::vector<std::string> roles;     // Handle -> role name
+    std::vector<int> styles;            // Handle -> resolved attribute
+    std::map<std::string, int> specs;   // Role name -> attribute from file
+
+    // Color pairs are shared between roles and kept across reloads
+    std::map<std::pair<short, short>, short> pairs;
+    short nextPair;
+
+    // Turn the right hand side of a theme line into an attribute
+    int parseSpec(const std::string & spec, const std::string & where);
+    short allocatePair(short foreground, short background);
+    // Fill in styles from specs, for every registered role
+    void resolve();
+
+public:
+    // Themes need curses to be running, so make them after the Engine
+    Theme();
+    ~Theme();
+
+    // Look up (or register) a role, returning its handle
+    int getStyle(std::string role);
+    // The resolved attribute for a handle, ready for setAttributes()
+    int attribute(int handle) const {
+        return styles[handle];
+    }
+
+    // Load a theme file and start watching it for changes. The user is
+    // responsible for catching InvalidThemeExceptions.
+    void load(std::string pathIn);
+    // Reload the theme if the file has changed, returning true if it did.
+    // An invalid file keeps the old styles, and getError() says why.
+    bool poll();
+    const std::string & getError();
+
+    // Changes whenever the styles do, so callers can cache against it
+    int getGeneration();
+
+    // Panels and the BorderCompositor draw with the active Theme, if any
+    static void setActive(Theme * theme);
+    static Theme * getActive();
+
+};
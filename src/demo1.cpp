@@ -76,7 +76,7 @@ public:
     // 'q' is the only key that will exit the loop.
     void run() override {
         int key;
-        while((key = getch()) != 'q') {
+        while((key = getInput()) != 'q') {
             // Do nothing until user presses 'q'
         }
     }
@@ -0,0 +1,131 @@
+/*
+ * In this example, we show how one Engine can drive a second terminal, like
+ * one left open on another monitor. Run `tty` in the other terminal, leave it
+ * sitting on something that doesn't read the keyboard (like `sleep 1000`),
+ * and pass its path to the demo:
+ *
+ *     ./demos/demo10 /dev/pts/3
+ *
+ * Each terminal has its own layout and borders, but they share one history.
+ * Keys typed into either terminal show up on both.
+ */
+
+#include "vexes.hpp"
+
+// Everything that lives on one terminal
+struct Screen {
+    LayoutTree * layout;
+    BorderCompositor * borders;
+    Panel * history;
+    Panel * info;
+};
+
+class MyEngine : public Engine {
+
+private:
+    const char * path;
+    std::vector<Screen> screens;        // One per terminal, in order
+    std::vector<std::string> history;   // Shared by every terminal
+    std::string error;
+
+    // Build a Screen on whichever terminal is selected
+    void addScreen() {
+        Screen screen;
+        screen.layout = new LayoutTree(LayoutTree::HORIZONTAL, "2:1");
+        screen.history = new Panel(Box(), "History");
+        screen.info = new Panel(Box(), "Terminal " + std::to_string(getSelectedTerminal()));
+        screen.layout->attachPanel(0, 0, screen.history);
+        screen.layout->attachPanel(0, 1, screen.info);
+        screen.layout->layout();
+        screen.borders = new BorderCompositor(screen.layout);
+        screens.push_back(screen);
+    }
+
+    void drawScreen(int index) {
+        // Borders and layouts work on the selected terminal, while Panels
+        // know which terminal they're on already
+        selectTerminal(index);
+        Screen & screen = screens[index];
+        screen.borders->draw();
+
+        WINDOW * win = screen.history->getWin();
+        int lines = getmaxy(win);
+        werase(win);
+        int first = std::max((int)history.size() - lines, 0);
+        for(int i = first; i < (int)history.size(); i++) {
+            drawStringAtPoint(history[i], Point(1, i - first), win);
+        }
+
+        win = screen.info->getWin();
+        werase(win);
+        drawStringAtPoint(std::to_string(COLS) + "x" + std::to_string(LINES), Point(1, 0), win);
+        drawStringAtPoint(getBackend() == EngineSettings::DIRECT_BACKEND ?
+                          "Direct backend" : "Curses backend", Point(1, 1), win);
+        drawStringAtPoint(error, Point(1, 3), win);
+
+        screen.history->drawPanel();
+        screen.info->drawPanel();
+    }
+
+public:
+    MyEngine(const char * pathIn) : path(pathIn) {}
+
+    void init() override {
+        addScreen();
+
+        // Opening a terminal doesn't select it, so we do that before
+        // building anything that should appear on it
+        if(path != NULL) {
+            int other = openTerminal(path);
+            if(other < 0) {
+                error = std::string("Can't open ") + path;
+            } else {
+                selectTerminal(other);
+                addScreen();
+                selectTerminal(0);
+            }
+        }
+    }
+
+    void run() override {
+        int key;
+        while((key = getInput()) != 'q') {
+            // getInput() leaves the terminal the key came from selected
+            int from = getSelectedTerminal();
+            if(key == KEY_RESIZE) {
+                screens[from].layout->layout();
+            } else if(key != ERR) {
+                std::string name = keyname(key) ? keyname(key) : "?";
+                history.push_back("Terminal " + std::to_string(from) + ": " + name);
+            }
+
+            for(int i = 0; i < (int)screens.size(); i++) {
+                drawScreen(i);
+            }
+        }
+    }
+
+    ~MyEngine() {
+        // Panels have to go before the Engine closes their terminals
+        for(Screen & screen : screens) {
+            delete screen.borders;
+            delete screen.layout;
+            delete screen.history;
+            delete screen.info;
+        }
+    }
+
+};
+
+int main(int argc, char ** argv) {
+
+    MyEngine * myEngine = new MyEngine((argc > 1) ? argv[1] : NULL);
+
+    myEngine->init();
+    myEngine->run();
+
+    delete myEngine;
+
+    return 0;
+
+}
@@ -0,0 +1,130 @@
+/*
+ * In this example, we show how an app can do things over time without the
+ * Engine waking up every few milliseconds to check. A timer ticks the clock
+ * once a second, and pressing space spins the spinner for two seconds. The
+ * rest of the time, the demo sleeps and uses no CPU at all. Pressing e opens
+ * a Form to change what the spinner says. The clock's timer keeps firing
+ * while it's open, but the Form doesn't draw Panels, so it doesn't wake up
+ * for them either, and the clock catches up once the Form is done.
+ */
+
+#include "vexes.hpp"
+
+#include <ctime>
+
+class MyEngine : public Engine {
+
+private:
+    Panel * clock;
+    Panel * spinner;
+    int clockTimer;
+    int spinTimer = 0;
+    int frame = 0;
+    std::string label = "Press space to spin";
+
+    // The bottom line is left for the Form
+    void layoutPanels() {
+        int split = COLS / 2;
+        clock->resizePanel(Box(Point(0, 0), Point(split - 1, LINES - 2)));
+        spinner->resizePanel(Box(Point(split, 0), Point(COLS - 1, LINES - 2)));
+    }
+
+    void editLabel() {
+        Form form(Point(0, LINES - 1), "Spinner says:");
+        form.injectString(label);
+        std::string edited = form.edit();
+        if(!edited.empty()) {
+            label = edited;
+        }
+        spinner->invalidate();
+    }
+
+    void drawClock() {
+        char now[16];
+        time_t seconds = time(NULL);
+        strftime(now, sizeof(now), "%H:%M:%S", localtime(&seconds));
+
+        WINDOW * win = clock->getWin();
+        werase(win);
+        drawCenteredStringAtPoint(now, Point(getmaxx(win) / 2, getmaxy(win) / 2), win);
+        clock->drawPanel();
+    }
+
+    void drawSpinner() {
+        static const char * frames = "|/-\\";
+        char spin[2] = { frames[frame % 4], '\0' };
+        const char * text = label.c_str();
+        if(spinTimer != 0) {
+            text = spin;
+            frame++;
+        }
+
+        WINDOW * win = spinner->getWin();
+        werase(win);
+        drawCenteredStringAtPoint(text, Point(getmaxx(win) / 2, getmaxy(win) / 2), win);
+        spinner->drawPanel();
+    }
+
+public:
+    void init() override {
+        clock = new Panel(Box(), "Clock");
+        spinner = new Panel(Box(), "Spinner");
+        layoutPanels();
+
+        // The timer only marks the clock for drawing, and getInput() returns
+        // so the loop below gets to do it
+        clockTimer = addTimer(1000, [this]() { clock->invalidate(); }, true, "clock");
+
+        clock->invalidate();
+        spinner->invalidate();
+    }
+
+    void run() override {
+        int key;
+        while((key = getInput()) != 'q') {
+            if(key == KEY_RESIZE) {
+                layoutPanels();
+                clock->invalidate();
+                spinner->invalidate();
+            } else if(key == ' ' && spinTimer == 0) {
+                // Until the animation ends, getInput() returns every frame
+                beginAnimation();
+                spinTimer = addTimer(2000, [this]() {
+                    endAnimation();
+                    spinTimer = 0;
+                    spinner->invalidate();
+                }, false, "spin");
+            } else if(key == 'e' && spinTimer == 0) {
+                editLabel();
+            }
+
+            if(clock->isInvalidated()) {
+                drawClock();
+            }
+            if(spinner->isInvalidated() || spinTimer != 0) {
+                drawSpinner();
+            }
+        }
+    }
+
+    ~MyEngine() {
+        removeTimer(clockTimer);
+        removeTimer(spinTimer);
+        delete clock;
+        delete spinner;
+    }
+
+};
+
+int main() {
+
+    MyEngine * myEngine = new MyEngine();
+
+    myEngine->init();
+    myEngine->run();
+
+    delete myEngine;
+
+    return 0;
+
+}
@@ -0,0 +1,105 @@
+/*
+ * In this example, we show how to let the Engine own our Panels through its
+ * Pool, and refer to them with Handles instead of raw pointers. Pressing tab
+ * tears down the current screen and builds the other one. The Panels of the
+ * old screen go back to the Pool, and the new ones reuse their slots, so
+ * switching back and forth doesn't keep going back to the heap. A Handle
+ * kept from the old screen safely comes back NULL instead of pointing at
+ * whatever took its place.
+ */
+
+#include "vexes.hpp"
+
+class MyEngine : public Engine {
+
+private:
+    std::vector<Pool<Panel>::Handle> screen;
+    Pool<Panel>::Handle previous;   // The first Panel of the last screen
+    bool overview = true;
+
+    // Both layouts are worked out up front, and again only when the
+    // terminal is resized, so switching screens doesn't make new ones
+    std::vector<Box> overviewBoxes;
+    std::vector<Box> detailBoxes;
+
+    void calculateLayouts() {
+        overviewBoxes.assign(1, Box(Point(0, 0), Point(COLS - 1, LINES - 1)));
+        detailBoxes = Layouts::customHLayout("1:2:1");
+    }
+
+    void buildScreen() {
+        previous = screen.empty() ? Pool<Panel>::Handle() : screen[0];
+        for(Pool<Panel>::Handle handle : screen) {
+            panelPool.destroy(handle);
+        }
+        screen.clear();
+
+        if(overview) {
+            screen.push_back(panelPool.create(Box(), "Overview"));
+        } else {
+            screen.push_back(panelPool.create(Box(), "Inbox"));
+            screen.push_back(panelPool.create(Box(), "Message"));
+            screen.push_back(panelPool.create(Box(), "Contacts"));
+        }
+        layoutScreen();
+    }
+
+    void layoutScreen() {
+        const std::vector<Box> & boxes = overview ? overviewBoxes : detailBoxes;
+        for(size_t i = 0; i < screen.size(); i++) {
+            panelPool.get(screen[i])->resizePanel(boxes[i]);
+        }
+    }
+
+    void drawScreen() {
+        // Nothing else has to know which Panels make up the screen
+        panelPool.forEach([](Panel & panel) { panel.drawPanel(); });
+
+        // The note goes in the middle Panel, which is the widest
+        Panel * middle = panelPool.get(screen[screen.size() / 2]);
+        WINDOW * win = middle->getWin();
+        const char * note = "Press tab to switch screens";
+        if(panelPool.get(previous) == NULL && previous != Pool<Panel>::Handle()) {
+            note = "The last screen's Handles are stale";
+        }
+        drawStringAtPoint(note, Point(2, 2), win);
+        middle->drawPanel();
+    }
+
+public:
+    void init() override {
+        calculateLayouts();
+        buildScreen();
+    }
+
+    void run() override {
+        int key;
+        drawScreen();
+        while((key = getInput()) != 'q') {
+            if(key == KEY_RESIZE) {
+                calculateLayouts();
+                layoutScreen();
+            } else if(key == '\t') {
+                overview = !overview;
+                buildScreen();
+            }
+            drawScreen();
+        }
+    }
+
+    // The Engine destroys whatever is left in its Pool for us
+
+};
+
+int main() {
+
+    MyEngine * myEngine = new MyEngine();
+
+    myEngine->init();
+    myEngine->run();
+
+    delete myEngine;
+
+    return 0;
+
+}
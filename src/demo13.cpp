@@ -0,0 +1,164 @@
+/*
+ * In this example, we show how to put Panels inside another Panel, and how
+ * to let the Engine work out which Panels to draw. The Panels in the
+ * sidebar are made with the sidebar as their parent, so their windows are
+ * views into the sidebar's window instead of windows of their own. When the
+ * terminal shrinks, the sidebar is resized first, and for a moment the
+ * Panels inside it don't fit. They get windows of their own until they're
+ * resized too, and then go back to being views.
+ *
+ * Pressing j moves the selection down the sidebar. Only the Panels that
+ * change are invalidated, and drawInvalidatedPanels() draws just those. The
+ * Panels inside the sidebar get a higher z-order, so whenever the sidebar
+ * is drawn, they're drawn over it.
+ */
+
+#include "vexes.hpp"
+
+// Each item in the sidebar knows whether it's the selected one
+class ItemPanel : public Panel {
+
+public:
+    bool selected = false;
+
+    ItemPanel(Panel * parent, Box dimensions, std::string title) :
+        Panel(parent, dimensions, title) {}
+
+    void drawPanel() override {
+        werase(win);
+        if(selected) {
+            drawCenteredStringAtPoint("> selected <", Point(columns / 2, lines / 2), win);
+        }
+        Panel::drawPanel();
+    }
+
+};
+
+// The main Panel shows whichever item is selected
+class ContentPanel : public Panel {
+
+public:
+    Panel * showing = NULL;
+
+    ContentPanel(Box dimensions, std::string title) : Panel(dimensions, title) {}
+
+    void drawPanel() override {
+        werase(win);
+        if(showing != NULL) {
+            drawCenteredStringAtPoint("Showing", Point(columns / 2, lines / 2 - 1), win);
+            drawCenteredStringAtPoint(showing->getTitle(), Point(columns / 2, lines / 2), win);
+        }
+        Panel::drawPanel();
+    }
+
+};
+
+class MyEngine : public Engine {
+
+private:
+    Panel * sidebar;
+    ContentPanel * content;
+    std::vector<ItemPanel *> items;
+    size_t selected = 0;
+
+    // The Panels inside the sidebar fill it, just inside its border
+    static std::vector<Box> itemBoxes(Box outer) {
+        Box inside(Point(outer.ul.x + 1, outer.ul.y + 1),
+                   Point(outer.lr.x - 1, outer.lr.y - 1));
+        return Layouts::VThirds(&inside);
+    }
+
+    void layoutPanels() {
+        std::vector<Box> outer = Layouts::customHLayout("1:2");
+        sidebar->resizePanel(outer[0]);
+        content->resizePanel(outer[1]);
+
+        std::vector<Box> inner = itemBoxes(outer[0]);
+        for(size_t i = 0; i < items.size(); i++) {
+            items[i]->resizePanel(inner[i]);
+        }
+    }
+
+    void invalidateAll() {
+        sidebar->invalidate();
+        content->invalidate();
+        for(ItemPanel * item : items) {
+            item->invalidate();
+        }
+    }
+
+    void select(size_t next) {
+        items[selected]->selected = false;
+        items[selected]->invalidate();
+        selected = next;
+        items[selected]->selected = true;
+        items[selected]->invalidate();
+        content->showing = items[selected];
+        content->invalidate();
+    }
+
+public:
+    void init() override {
+        try {
+            std::vector<Box> outer = Layouts::customHLayout("1:2");
+            sidebar = new Panel(outer[0], "Sidebar");
+            content = new ContentPanel(outer[1], "Main");
+
+            // Passing the sidebar as the parent is all it takes
+            std::vector<Box> inner = itemBoxes(outer[0]);
+            items.push_back(new ItemPanel(sidebar, inner[0], "Mail"));
+            items.push_back(new ItemPanel(sidebar, inner[1], "Calendar"));
+            items.push_back(new ItemPanel(sidebar, inner[2], "Contacts"));
+            for(ItemPanel * item : items) {
+                item->setZOrder(1);
+            }
+
+            select(0);
+            invalidateAll();
+        } catch(InvalidRatioException& e) {
+            drawStringAtPoint(e.what(), Point(0, 0));
+        }
+    }
+
+    void run() override {
+        int key;
+        while((key = getInput()) != 'q') {
+            switch(key) {
+                case KEY_RESIZE:
+                    layoutPanels();
+                    invalidateAll();
+                    break;
+                case 'j':
+                    select((selected + 1) % items.size());
+                    break;
+                default:
+                    break;
+            }
+
+            drawInvalidatedPanels();
+        }
+    }
+
+    // The Panels inside go before the sidebar they're views into
+    ~MyEngine() {
+        for(ItemPanel * item : items) {
+            delete item;
+        }
+        delete sidebar;
+        delete content;
+    }
+
+};
+
+int main() {
+
+    MyEngine * myEngine = new MyEngine();
+
+    myEngine->init();
+    myEngine->run();
+
+    delete myEngine;
+
+    return 0;
+
+}
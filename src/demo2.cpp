@@ -93,7 +93,7 @@ public:
     // input, we want to render our Panels to the screen.
     void run() override {
         int key;
-        while((key = getch()) != 'q') {
+        while((key = getInput()) != 'q') {
             // We want our Panels to resize if the window changes,
             // so let's handle that before we render them.
             switch(key) {
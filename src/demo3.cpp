@@ -96,7 +96,7 @@ public:
     // Override run to handle rendering and user input
     void run() override {
         int key;
-        while((key = getch()) != 'q') {
+        while((key = getInput()) != 'q') {
             // Render our custom Panel
             myPanel->drawPanel();
         }
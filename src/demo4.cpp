@@ -41,7 +41,7 @@ public:
 
     void run() override {
         int key;
-        while((key = getch()) != 'q') {
+        while((key = getInput()) != 'q') {
             // Here we wait for the user to press ENTER, then edit our Form
             if(key == 10) { // Enter key
                 std::string input = myForm->edit();
@@ -0,0 +1,117 @@
+/*
+ * In this example, we show how to use a LayoutTree to build the same kind of
+ * layouts as demo2, but with borders the user can drag around with the mouse.
+ * We also let a BorderCompositor draw the borders, so neighbouring Panels
+ * share them instead of each drawing their own box.
+ */
+
+// As usual, include the header
+#include "vexes.hpp"
+
+class MyEngine : public Engine {
+
+private:
+    // The LayoutTree remembers which Panel goes where, so we don't have to
+    // pair Boxes up with Panels ourselves like we did in demo2
+    LayoutTree * layout;
+    BorderCompositor * borders;
+    std::vector<Panel *> panels;
+
+public:
+    void init() override {
+        // Mouse support is off by default, so we turn it on here
+        enableMouse();
+
+        try {
+            // The root split is made along with the tree, and is always
+            // referred to as split 0. It has one slot per ratio number.
+            layout = new LayoutTree(LayoutTree::HORIZONTAL, "1:1:2");
+
+            // Any slot can be turned into a split of its own. addSplit()
+            // gives us back the index of the new split.
+            int inner = layout->addSplit(0, 1, LayoutTree::VERTICAL, "1:1:1");
+
+            // Panels don't need real dimensions yet, since the tree will
+            // size them for us once we lay it out
+            for(int i = 0; i < 5; i++) {
+                panels.push_back(new Panel(Box()));
+            }
+
+            panels[0]->setTitle("Drag Me");
+            panels[1]->setTitle("Or Me");
+            panels[2]->setTitle("Inner Panel 1");
+            panels[3]->setTitle("Inner Panel 2");
+            panels[4]->setTitle("Inner Panel 3");
+
+            layout->attachPanel(0, 0, panels[0]);
+            layout->attachPanel(0, 2, panels[1]);
+            layout->attachPanel(inner, 0, panels[2]);
+            layout->attachPanel(inner, 1, panels[3]);
+            layout->attachPanel(inner, 2, panels[4]);
+
+            // With no Box given, the tree fills stdscr
+            layout->layout();
+
+            // The compositor takes over drawing borders for every Panel in
+            // the tree. Shared edges are drawn once, with proper junctions.
+            borders = new BorderCompositor(layout);
+        } catch(InvalidRatioException& e) {
+            drawStringAtPoint(e.what(), Point(0, 0));
+        }
+    }
+
+    void run() override {
+        int key;
+        MEVENT event;
+        while((key = getInput()) != 'q') {
+            switch(key) {
+                case KEY_RESIZE:
+                    // The tree keeps any dragged sizes as it re-lays out
+                    layout->layout();
+                    break;
+                case KEY_MOUSE:
+                    // Mouse events just tell the tree where the mouse is
+                    if(getMouseInput(event)) {
+                        layout->handleMouse(event);
+                    }
+                    break;
+                default:
+                    break;
+            }
+
+            // The actual re-layout happens here, at most once per frame, and
+            // only for the Panels on either side of the dragged border
+            layout->update();
+
+            // Borders are only redrawn if the layout actually changed, and
+            // must go down before the Panels are drawn over them
+            borders->draw();
+
+            for(Panel * p : panels) {
+                p->drawPanel();
+            }
+        }
+    }
+
+    ~MyEngine() {
+        delete borders;
+        delete layout;
+        for(Panel * p : panels) {
+            delete p;
+        }
+    }
+
+};
+
+int main() {
+
+    MyEngine * myEngine = new MyEngine();
+
+    myEngine->init();
+    myEngine->run();
+
+    delete myEngine;
+
+    return 0;
+
+}
@@ -0,0 +1,96 @@
+/*
+ * In this example, we show how to use a ResponsiveLayout to switch between
+ * different layouts depending on the size of the terminal. Try resizing your
+ * terminal to see the layout change!
+ */
+
+#include "vexes.hpp"
+
+class MyEngine : public Engine {
+
+private:
+    // We make all of our Panels once, and every layout reuses them
+    std::vector<Panel *> panels;
+    std::vector<LayoutTree *> layouts;
+    ResponsiveLayout * responsive;
+
+public:
+    void init() override {
+        try {
+            panels.push_back(new Panel(Box(), "Navigation"));
+            panels.push_back(new Panel(Box(), "Content"));
+            panels.push_back(new Panel(Box(), "Details"));
+
+            // Small terminals get the navigation stacked above the content,
+            // and no details Panel at all
+            LayoutTree * small = new LayoutTree(LayoutTree::VERTICAL, "1:3");
+            small->attachPanel(0, 0, panels[0]);
+            small->attachPanel(0, 1, panels[1]);
+
+            // Medium terminals put the navigation beside the content
+            LayoutTree * medium = new LayoutTree(LayoutTree::HORIZONTAL, "1:3");
+            medium->attachPanel(0, 0, panels[0]);
+            medium->attachPanel(0, 1, panels[1]);
+
+            // Large terminals have room for everything
+            LayoutTree * large = new LayoutTree(LayoutTree::HORIZONTAL, "1:3:1");
+            large->attachPanel(0, 0, panels[0]);
+            large->attachPanel(0, 1, panels[1]);
+            large->attachPanel(0, 2, panels[2]);
+
+            layouts = {small, medium, large};
+
+            // Breakpoints are added from smallest to largest, and each one
+            // says how many columns and lines it needs at minimum
+            responsive = new ResponsiveLayout();
+            responsive->addBreakpoint(0, 0, small);
+            responsive->addBreakpoint(80, 0, medium);
+            responsive->addBreakpoint(120, 30, large);
+
+            // Pick the right layout for whatever size we're starting at
+            responsive->resize();
+        } catch(InvalidRatioException& e) {
+            drawStringAtPoint(e.what(), Point(0, 0));
+        }
+    }
+
+    void run() override {
+        int key;
+        while((key = getInput()) != 'q') {
+            if(key == KEY_RESIZE) {
+                // Switching layouts is just a table lookup, and the Panels
+                // are resized rather than recreated
+                responsive->resize();
+            }
+
+            // Only draw the Panels that are part of the current layout
+            for(Panel * p : responsive->getActivePanels()) {
+                p->drawPanel();
+            }
+        }
+    }
+
+    ~MyEngine() {
+        delete responsive;
+        for(LayoutTree * layout : layouts) {
+            delete layout;
+        }
+        for(Panel * p : panels) {
+            delete p;
+        }
+    }
+
+};
+
+int main() {
+
+    MyEngine * myEngine = new MyEngine();
+
+    myEngine->init();
+    myEngine->run();
+
+    delete myEngine;
+
+    return 0;
+
+}
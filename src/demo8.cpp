@@ -0,0 +1,104 @@
+/*
+ * In this example, we show how to load a layout from a file with LayoutFile,
+ * and colors from a Theme file. While the demo is running, try editing
+ * layouts/dashboard.layout or themes/dashboard.theme (or whichever files you
+ * passed in) and saving them. The demo will update live!
+ */
+
+#include "vexes.hpp"
+
+class MyEngine : public Engine {
+
+private:
+    LayoutFile * layoutFile;
+    Theme * theme;
+    std::string path;
+    std::string themePath;
+
+    void drawError() {
+        // If a file is broken we keep the old one, and show the problem.
+        // Looking up the error style is just an array index, so it's fine to
+        // do it every time we draw.
+        const std::string & error = layoutFile->getError().empty() ?
+            theme->getError() : layoutFile->getError();
+        if(!error.empty()) {
+            setAttributes(theme->attribute(Theme::ERROR));
+            drawStringAtPoint(error, Point(0, LINES - 1));
+            unsetAttributes(theme->attribute(Theme::ERROR));
+        }
+    }
+
+public:
+    MyEngine(std::string pathIn, std::string themePathIn) :
+        path(pathIn), themePath(themePathIn) {}
+
+    void init() override {
+        // Any Panel named in the file that we haven't registered ourselves
+        // is made for us, so for this demo we don't need to make any
+        layoutFile = new LayoutFile(path);
+
+        // Default Panels draw their borders and titles with the active Theme
+        theme = new Theme();
+        Theme::setActive(theme);
+
+        try {
+            // Themes are resolved into attributes and color pairs up front
+            theme->load(themePath);
+            // The file is parsed once here, and then watched for changes
+            layoutFile->load();
+        } catch(InvalidThemeException& e) {
+            drawStringAtPoint(e.what(), Point(0, 0));
+        } catch(InvalidLayoutException& e) {
+            drawStringAtPoint(e.what(), Point(0, 0));
+        }
+    }
+
+    void run() override {
+        int key;
+        while((key = getInput()) != 'q') {
+            LayoutTree * layout = layoutFile->getLayout();
+            if(layout == NULL) { continue; }
+
+            if(key == KEY_RESIZE) {
+                layout->layout();
+            }
+
+            // Checking for changes is cheap, so we can do it every frame.
+            // Only Panels whose bounds changed get resized, so we touch the
+            // rest to put them back over any old error message we cleared.
+            if(layoutFile->poll() | theme->poll()) {
+                erase();
+                for(Panel * p : layout->getPanels()) {
+                    touchwin(p->getWin());
+                }
+            }
+
+            for(Panel * p : layout->getPanels()) {
+                p->drawPanel();
+            }
+            drawError();
+        }
+    }
+
+    ~MyEngine() {
+        // The LayoutFile cleans up the Panels it made
+        delete layoutFile;
+        delete theme;
+    }
+
+};
+
+int main(int argc, char ** argv) {
+
+    std::string path = (argc > 1) ? argv[1] : "layouts/dashboard.layout";
+    std::string themePath = (argc > 2) ? argv[2] : "themes/dashboard.theme";
+    MyEngine * myEngine = new MyEngine(path, themePath);
+
+    myEngine->init();
+    myEngine->run();
+
+    delete myEngine;
+
+    return 0;
+
+}
@@ -0,0 +1,90 @@
+/*
+ * In this example, we show how a Panel can scroll its contents, like a log
+ * that keeps growing at the bottom. When the Panel spans the whole width of
+ * the terminal, the terminal itself does the scrolling, so each new line
+ * costs about as much to send as the line itself.
+ */
+
+#include "vexes.hpp"
+
+// Our log Panel only ever draws its newest line, and lets scrollContent()
+// move everything else out of the way
+class LogPanel : public Panel {
+
+private:
+    int count = 0;
+    bool hardware = false;
+
+public:
+    LogPanel(Box globalDimensionsIn, std::string titleIn = "") :
+        Panel(globalDimensionsIn, titleIn) {}
+
+    void addLine() {
+        // Everything moves up one line, leaving the bottom line blank
+        hardware = scrollContent(1);
+
+        std::string line = "Log line " + std::to_string(++count);
+        drawStringAtPoint(line, Point(2, lines - 1), win);
+    }
+
+    bool isHardware() {
+        return hardware;
+    }
+
+};
+
+class MyEngine : public Engine {
+
+private:
+    Panel * status;
+    LogPanel * log;
+
+public:
+    void init() override {
+        // The log spans the full width of the terminal, so it can use the
+        // terminal's scrolling
+        int split = LINES / 4;
+        status = new Panel(Box(Point(0, 0), Point(COLS - 1, split - 1)), "Status");
+        log = new LogPanel(Box(Point(0, split), Point(COLS - 1, LINES - 1)), "Log");
+    }
+
+    void run() override {
+        int key;
+        while((key = getInput()) != 'q') {
+            if(key == KEY_RESIZE) {
+                int split = LINES / 4;
+                status->resizePanel(Box(Point(0, 0), Point(COLS - 1, split - 1)));
+                log->resizePanel(Box(Point(0, split), Point(COLS - 1, LINES - 1)));
+            } else if(key != ERR) {
+                // Any key adds a line to the log
+                log->addLine();
+            }
+
+            const char * mode = log->isHardware() ? "Scrolling: terminal"
+                                                  : "Scrolling: redrawn";
+            drawStringAtPoint(mode, Point(2, 1), status->getWin());
+
+            status->drawPanel();
+            log->drawPanel();
+        }
+    }
+
+    ~MyEngine() {
+        delete status;
+        delete log;
+    }
+
+};
+
+int main() {
+
+    MyEngine * myEngine = new MyEngine();
+
+    myEngine->init();
+    myEngine->run();
+
+    delete myEngine;
+
+    return 0;
+
+}
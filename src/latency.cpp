@@ -0,0 +1,815 @@
+/*
+ * This is a small harness for measuring the input-to-output latency of any
+ * vexes program (or any terminal program, really). It runs the program in a
+ * pseudo-terminal, types keys into it on a schedule, and watches what comes
+ * back. For every key, it reports how long it took for the first byte of the
+ * response to show up, how long until the last byte did, and how many bytes
+ * the response was. Output that arrives after a response has gone quiet is
+ * counted separately, since no key can take credit for it.
+ *
+ * Everything the program writes is also run through a small virtual terminal,
+ * which keeps track of what's on screen and counts how many cursor moves,
+ * attribute changes, and erases each response took. That makes it easy to
+ * check whether a change made the output any cheaper, or to script a check
+ * that some text actually made it to the screen.
+ *
+ * The reading side can be throttled to a number of bytes per second, which
+ * lets the pseudo-terminal fill up the same way a slow SSH link would, so
+ * we can see how a program behaves over one without leaving the machine.
+ *
+ * Usage: latency [options] -- program [arguments...]
+ *
+ *     -k KEYS     Keys to type, one per step. Supports \e, \n, \r, \t, \\
+ *                 and \xNN escapes. Default is "q".
+ *     -f FILE     Read steps from a file instead. Each line is a delay in
+ *                 milliseconds (since the previous step) and the keys to
+ *                 type, e.g. "100 \e[A". Blank lines and # comments are
+ *                 skipped.
+ *     -i MS       Milliseconds between steps given with -k (default 100)
+ *     -w MS       Milliseconds to let the program start up (default 500)
+ *     -q MS       Quiet period that marks the end of a response (default 50)
+ *     -b BYTES    Only read this many bytes per second (default unlimited)
+ *     -s WxH      Size of the terminal (default 80x24)
+ *     -t TERM     TERM for the program (default xterm-256color)
+ *     -d          Print the screen as it was when the program exited
+ *     -x TEXT     Exit with an error unless TEXT is on that screen. This can
+ *                 be given more than once.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <poll.h>
+#include <pty.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+///////////////////////////// VIRTUAL TERMINAL //////////////////////////////
+
+/*
+ * A VirtualTerminal is a small VT100/xterm interpreter. We feed it the raw
+ * output of the program, and it keeps a copy of what the screen would look
+ * like, while counting the kinds of work the output asked the terminal to do.
+ * It only understands what ncurses actually sends, and quietly skips anything
+ * else, so it's meant for measuring and checking output, not for display.
+ */
+class VirtualTerminal {
+
+public:
+    struct Counts {
+
+        size_t bytes = 0;
+        size_t printable = 0;   // Bytes of text that ended up on screen
+        size_t cursorMoves = 0; // Cursor addressing, plus CR, LF and BS
+        size_t sgrChanges = 0;  // Each SGR sequence, however many attributes
+        size_t erases = 0;      // Erasing the screen, lines, or characters
+        size_t scrolls = 0;     // Scroll regions, index, and line insertion
+        size_t other = 0;       // Sequences that change none of the above
+
+        Counts & operator+=(const Counts & c) {
+            bytes += c.bytes; printable += c.printable;
+            cursorMoves += c.cursorMoves; sgrChanges += c.sgrChanges;
+            erases += c.erases; scrolls += c.scrolls; other += c.other;
+            return *this;
+        }
+
+        Counts operator-(const Counts & c) const {
+            Counts d;
+            d.bytes = bytes - c.bytes; d.printable = printable - c.printable;
+            d.cursorMoves = cursorMoves - c.cursorMoves;
+            d.sgrChanges = sgrChanges - c.sgrChanges;
+            d.erases = erases - c.erases; d.scrolls = scrolls - c.scrolls;
+            d.other = other - c.other;
+            return d;
+        }
+
+    };
+
+private:
+    enum State { GROUND, ESCAPE, CHARSET, CSI, STRING, STRING_ESCAPE };
+
+    int columns, lines;
+    std::vector<std::string> cells;  // One UTF-8 character per cell
+    int x, y;
+    int savedX, savedY;
+    int top, bottom;                 // Scroll region, inclusive
+    bool pendingWrap;
+    std::string lastPrinted;
+    bool graphics[2];                // Which of G0 and G1 are line drawing
+    int shift;                       // Which of G0 and G1 is in use
+    char designating;
+    std::string utf8;
+    size_t utf8Left;
+
+    State state;
+    std::string params;
+    Counts counts;
+
+    std::string & cell(int cx, int cy) { return cells[cy * columns + cx]; }
+
+    void clamp() {
+        x = std::max(0, std::min(x, columns - 1));
+        y = std::max(0, std::min(y, lines - 1));
+        pendingWrap = false;
+    }
+
+    void clearCells(int fromX, int fromY, int toX, int toY) {
+        for(int i = fromY * columns + fromX; i <= toY * columns + toX; i++) {
+            cells[i] = " ";
+        }
+    }
+
+    // Move the lines of the scroll region from 'first' down by n (or up, if
+    // n is negative), leaving blank lines behind
+    void shiftLines(int first, int n) {
+        if(first < top || first > bottom) { return; }
+        std::vector<std::string> region(cells.begin() + first * columns,
+                                        cells.begin() + (bottom + 1) * columns);
+        std::fill(cells.begin() + first * columns, cells.begin() + (bottom + 1) * columns, " ");
+        int height = bottom - first + 1;
+        for(int row = 0; row < height; row++) {
+            int to = row + n;
+            if(to < 0 || to >= height) { continue; }
+            std::copy(region.begin() + row * columns, region.begin() + (row + 1) * columns,
+                      cells.begin() + (first + to) * columns);
+        }
+    }
+
+    void lineFeed() {
+        if(y == bottom) { shiftLines(top, -1); counts.scrolls++; }
+        else if(y < lines - 1) { y++; }
+    }
+
+    // Translate DEC line drawing characters, so the screen reads properly
+    std::string translate(const std::string & ch) {
+        static const char * drawing = "jklmnqtuvwx`a~";
+        static const char * unicode[] = {"┘", "┐", "┌", "└", "┼", "─", "├", "┤",
+                                         "┴", "┬", "│", "◆", "▒", "·"};
+        if(!graphics[shift] || ch.size() != 1) { return ch; }
+        const char * found = strchr(drawing, ch[0]);
+        return (found && *found) ? unicode[found - drawing] : ch;
+    }
+
+    void put(const std::string & glyph) {
+        std::string ch = translate(glyph);
+        if(pendingWrap) {
+            x = 0;
+            lineFeed();
+            pendingWrap = false;
+        }
+        cell(x, y) = ch;
+        lastPrinted = glyph;
+        if(x == columns - 1) { pendingWrap = true; }
+        else { x++; }
+    }
+
+    int param(const std::vector<int> & p, size_t i, int fallback) {
+        return (i < p.size() && p[i] > 0) ? p[i] : fallback;
+    }
+
+    void dispatchCSI(char final) {
+        bool priv = !params.empty() && (params[0] == '?' || params[0] == '>' || params[0] == '=');
+        std::vector<int> p;
+        std::string digits = priv ? params.substr(1) : params;
+        size_t start = 0;
+        while(start <= digits.size()) {
+            size_t end = digits.find_first_of(";:", start);
+            if(end == std::string::npos) { end = digits.size(); }
+            p.push_back(atoi(digits.substr(start, end - start).c_str()));
+            start = end + 1;
+        }
+
+        if(priv) { counts.other++; return; }
+
+        int n = param(p, 0, 1);
+        switch(final) {
+            case 'A': y = std::max(y - n, 0); clamp(); counts.cursorMoves++; break;
+            case 'B': case 'e': y += n; clamp(); counts.cursorMoves++; break;
+            case 'C': case 'a': x += n; clamp(); counts.cursorMoves++; break;
+            case 'D': x -= n; clamp(); counts.cursorMoves++; break;
+            case 'E': x = 0; y += n; clamp(); counts.cursorMoves++; break;
+            case 'F': x = 0; y -= n; clamp(); counts.cursorMoves++; break;
+            case 'G': case '`': x = n - 1; clamp(); counts.cursorMoves++; break;
+            case 'd': y = n - 1; clamp(); counts.cursorMoves++; break;
+            case 'H': case 'f':
+                y = param(p, 0, 1) - 1;
+                x = param(p, 1, 1) - 1;
+                clamp();
+                counts.cursorMoves++;
+                break;
+            case 'J': {
+                int mode = p.empty() ? 0 : p[0];
+                if(mode == 0) { clearCells(x, y, columns - 1, lines - 1); }
+                else if(mode == 1) { clearCells(0, 0, x, y); }
+                else { clearCells(0, 0, columns - 1, lines - 1); }
+                counts.erases++;
+                break;
+            }
+            case 'K': {
+                int mode = p.empty() ? 0 : p[0];
+                if(mode == 0) { clearCells(x, y, columns - 1, y); }
+                else if(mode == 1) { clearCells(0, y, x, y); }
+                else { clearCells(0, y, columns - 1, y); }
+                counts.erases++;
+                break;
+            }
+            case 'X':
+                clearCells(x, y, std::min(x + n, columns) - 1, y);
+                counts.erases++;
+                break;
+            case 'P': {
+                auto row = cells.begin() + y * columns;
+                n = std::min(n, columns - x);
+                std::copy(row + x + n, row + columns, row + x);
+                std::fill(row + columns - n, row + columns, " ");
+                counts.erases++;
+                break;
+            }
+            case '@': {
+                auto row = cells.begin() + y * columns;
+                n = std::min(n, columns - x);
+                std::copy_backward(row + x, row + columns - n, row + columns);
+                std::fill(row + x, row + x + n, " ");
+                counts.other++;
+                break;
+            }
+            case 'L': shiftLines(y, n); counts.scrolls++; break;
+            case 'M': shiftLines(y, -n); counts.scrolls++; break;
+            case 'S': shiftLines(top, -n); counts.scrolls++; break;
+            case 'T': shiftLines(top, n); counts.scrolls++; break;
+            case 'r':
+                top = param(p, 0, 1) - 1;
+                bottom = param(p, 1, lines) - 1;
+                if(top >= bottom || bottom >= lines) { top = 0; bottom = lines - 1; }
+                x = 0; y = 0; pendingWrap = false;
+                counts.scrolls++;
+                break;
+            case 'b':
+                // REP repeats the last printed character, which ncurses
+                // uses for long runs of the same cell
+                for(int i = 0; i < n && !lastPrinted.empty(); i++) {
+                    put(lastPrinted);
+                }
+                counts.other++;
+                break;
+            case 'm': counts.sgrChanges++; break;
+            case 's': savedX = x; savedY = y; counts.other++; break;
+            case 'u': x = savedX; y = savedY; clamp(); counts.cursorMoves++; break;
+            default: counts.other++; break;
+        }
+    }
+
+    void dispatchEscape(char ch) {
+        switch(ch) {
+            case '7': savedX = x; savedY = y; counts.other++; break;
+            case '8': x = savedX; y = savedY; clamp(); counts.cursorMoves++; break;
+            case 'D': lineFeed(); counts.cursorMoves++; break;
+            case 'E': x = 0; lineFeed(); counts.cursorMoves++; break;
+            case 'M':
+                if(y == top) { shiftLines(top, 1); counts.scrolls++; }
+                else if(y > 0) { y--; counts.cursorMoves++; }
+                break;
+            case 'c': reset(); break;
+            default: counts.other++; break;
+        }
+    }
+
+    void feedByte(unsigned char ch) {
+        switch(state) {
+            case GROUND:
+                if(ch == 0x1b) { state = ESCAPE; return; }
+                if(ch < 0x20 || ch == 0x7f) {
+                    switch(ch) {
+                        case '\r': x = 0; pendingWrap = false; counts.cursorMoves++; break;
+                        case '\n': case '\v': case '\f':
+                            lineFeed(); pendingWrap = false; counts.cursorMoves++; break;
+                        case '\b': if(x > 0) { x--; } pendingWrap = false; counts.cursorMoves++; break;
+                        case '\t': x = std::min((x / 8 + 1) * 8, columns - 1); counts.cursorMoves++; break;
+                        case 0x0e: shift = 1; counts.other++; break;
+                        case 0x0f: shift = 0; counts.other++; break;
+                        default: counts.other++; break;
+                    }
+                    return;
+                }
+
+                counts.printable++;
+                if(ch < 0x80) { put(std::string(1, ch)); return; }
+                if(utf8Left > 0 && (ch & 0xc0) == 0x80) {
+                    utf8 += ch;
+                    if(--utf8Left == 0) { put(utf8); }
+                    return;
+                }
+                utf8 = std::string(1, ch);
+                utf8Left = (ch >= 0xf0) ? 3 : (ch >= 0xe0) ? 2 : (ch >= 0xc0) ? 1 : 0;
+                if(utf8Left == 0) { put("?"); }
+                return;
+            case ESCAPE:
+                state = GROUND;
+                if(ch == '[') { state = CSI; params.clear(); }
+                else if(ch == ']' || ch == 'P' || ch == '_' || ch == '^') { state = STRING; }
+                else if(ch == '(' || ch == ')' || ch == '*' || ch == '+' || ch == '#') {
+                    state = CHARSET;
+                    designating = ch;
+                }
+                else if(ch == '=' || ch == '>') { counts.other++; }
+                else { dispatchEscape(ch); }
+                return;
+            case CHARSET:
+                state = GROUND;
+                if(designating == '(' || designating == ')') {
+                    graphics[designating == ')'] = (ch == '0');
+                }
+                counts.other++;
+                return;
+            case CSI:
+                if(ch >= 0x40 && ch <= 0x7e) {
+                    state = GROUND;
+                    dispatchCSI(ch);
+                } else if(ch == 0x1b) {
+                    state = ESCAPE;
+                } else {
+                    params += ch;
+                }
+                return;
+            case STRING:
+                // OSC, DCS and friends end with BEL or ST, and draw nothing
+                if(ch == 0x07) { state = GROUND; counts.other++; }
+                else if(ch == 0x1b) { state = STRING_ESCAPE; }
+                return;
+            case STRING_ESCAPE:
+                state = (ch == '\\') ? GROUND : STRING;
+                if(state == GROUND) { counts.other++; }
+                return;
+        }
+    }
+
+public:
+    VirtualTerminal(int columnsIn, int linesIn) :
+        columns(columnsIn), lines(linesIn) {
+        reset();
+    }
+
+    void reset() {
+        cells.assign(columns * lines, " ");
+        x = y = savedX = savedY = 0;
+        top = 0;
+        bottom = lines - 1;
+        pendingWrap = false;
+        graphics[0] = graphics[1] = false;
+        shift = 0;
+        utf8Left = 0;
+        state = GROUND;
+    }
+
+    void feed(const char * data, size_t length) {
+        counts.bytes += length;
+        for(size_t i = 0; i < length; i++) {
+            feedByte((unsigned char)data[i]);
+        }
+    }
+
+    Counts getCounts() { return counts; }
+
+    std::string getLine(int row) {
+        std::string line;
+        for(int col = 0; col < columns; col++) {
+            line += cell(col, row);
+        }
+        return line;
+    }
+
+    bool contains(const std::string & text) {
+        for(int row = 0; row < lines; row++) {
+            if(getLine(row).find(text) != std::string::npos) { return true; }
+        }
+        return false;
+    }
+
+    void dump(FILE * out) {
+        for(int row = 0; row < lines; row++) {
+            std::string line = getLine(row);
+            line.erase(line.find_last_not_of(' ') + 1);
+            fprintf(out, "|%s\n", line.c_str());
+        }
+    }
+
+};
+
+///////////////////////////////// STRUCTS ////////////////////////////////////
+
+/*
+ * A Step is one batch of keys to type, and everything we measured about the
+ * program's response to it.
+ */
+struct Step {
+
+    int delay;          // Milliseconds after the previous step
+    std::string keys;
+
+    Clock::time_point sent;
+    bool responded;
+    double firstByte;   // Milliseconds from sending to the first byte back
+    double lastByte;    // Milliseconds from sending to the last byte back
+    VirtualTerminal::Counts counts;
+
+    Step(int delayIn, std::string keysIn) :
+        delay(delayIn), keys(keysIn), responded(false),
+        firstByte(0), lastByte(0) {}
+
+};
+
+/*
+ * Settings for a run, mostly filled in from the command line
+ */
+struct Options {
+
+    std::vector<Step> steps;
+    int interval = 100;
+    int startup = 500;
+    int quiet = 50;
+    long throttle = 0;  // Bytes per second, or 0 for no limit
+    int columns = 80;
+    int lines = 24;
+    std::string term = "xterm-256color";
+    bool dumpScreen = false;
+    std::vector<std::string> expected;  // Text that must be on the last screen
+    std::vector<char *> command;
+
+};
+
+////////////////////////////////// HELPERS ///////////////////////////////////
+
+static double millisecondsBetween(Clock::time_point a, Clock::time_point b) {
+    return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+// Turn escapes like \e and \x1b into the bytes they stand for
+static std::string unescapeKeys(const std::string & text) {
+    std::string keys;
+    for(size_t i = 0; i < text.size(); i++) {
+        if(text[i] != '\\' || i + 1 >= text.size()) {
+            keys += text[i];
+            continue;
+        }
+
+        char next = text[++i];
+        switch(next) {
+            case 'e': keys += '\033'; break;
+            case 'n': keys += '\n'; break;
+            case 'r': keys += '\r'; break;
+            case 't': keys += '\t'; break;
+            case 'x':
+                if(i + 2 < text.size()) {
+                    keys += (char)strtol(text.substr(i + 1, 2).c_str(), NULL, 16);
+                    i += 2;
+                }
+                break;
+            default: keys += next; break;
+        }
+    }
+
+    return keys;
+}
+
+static bool readScript(const char * path, std::vector<Step> & steps) {
+    std::ifstream file(path);
+    if(!file) { return false; }
+
+    std::string line;
+    while(std::getline(file, line)) {
+        size_t start = line.find_first_not_of(" \t");
+        if(start == std::string::npos || line[start] == '#') { continue; }
+
+        char * rest;
+        int delay = (int)strtol(line.c_str() + start, &rest, 10);
+        while(*rest == ' ' || *rest == '\t') { rest++; }
+        steps.push_back(Step(delay, unescapeKeys(rest)));
+    }
+
+    return true;
+}
+
+static void printUsage() {
+    fprintf(stderr, "Usage: latency [-k keys | -f script] [-i ms] [-w ms] [-q ms] "
+                    "[-b bytes] [-s WxH] [-t term] [-d] [-x text]... "
+                    "-- program [arguments...]\n");
+}
+
+static bool parseOptions(int argc, char ** argv, Options & options) {
+    std::string keys = "q";
+    bool haveScript = false;
+
+    int opt;
+    while((opt = getopt(argc, argv, "k:f:i:w:q:b:s:t:dx:")) != -1) {
+        switch(opt) {
+            case 'k': keys = unescapeKeys(optarg); break;
+            case 'f':
+                if(!readScript(optarg, options.steps)) {
+                    fprintf(stderr, "latency: could not read %s\n", optarg);
+                    return false;
+                }
+                haveScript = true;
+                break;
+            case 'i': options.interval = atoi(optarg); break;
+            case 'w': options.startup = atoi(optarg); break;
+            case 'q': options.quiet = atoi(optarg); break;
+            case 'b': options.throttle = atol(optarg); break;
+            case 's':
+                if(sscanf(optarg, "%dx%d", &options.columns, &options.lines) != 2) {
+                    return false;
+                }
+                break;
+            case 't': options.term = optarg; break;
+            case 'd': options.dumpScreen = true; break;
+            case 'x': options.expected.push_back(optarg); break;
+            default: return false;
+        }
+    }
+
+    if(optind >= argc) { return false; }
+    for(int i = optind; i < argc; i++) {
+        options.command.push_back(argv[i]);
+    }
+    options.command.push_back(NULL);
+
+    if(!haveScript) {
+        for(char key : keys) {
+            options.steps.push_back(Step(options.interval, std::string(1, key)));
+        }
+    }
+
+    return !options.steps.empty();
+}
+
+////////////////////////////////// HARNESS //////////////////////////////////
+
+/*
+ * The Harness owns the pseudo-terminal and the child program, and does the
+ * actual typing and measuring.
+ */
+class Harness {
+
+private:
+    Options & options;
+    int master;
+    pid_t child;
+
+    // Throttling is a simple token bucket, refilled every time we read
+    double allowance;
+    Clock::time_point lastRefill;
+
+    // Everything the program writes goes through here, so we can count what
+    // it asked the terminal to do and check what ended up on screen
+    VirtualTerminal screen;
+    VirtualTerminal::Counts otherCounts;  // Output no step can take credit for
+    Clock::time_point lastOutput;
+
+    // Read whatever the program has written, returning how much (or -1 once
+    // it has gone away). Output is credited to the current step, if any.
+    ssize_t drain(Step * step) {
+        size_t limit = 1 << 16;
+        if(options.throttle > 0) {
+            Clock::time_point now = Clock::now();
+            allowance += options.throttle * millisecondsBetween(lastRefill, now) / 1000.0;
+            allowance = std::min(allowance, (double)options.throttle);
+            lastRefill = now;
+            if(allowance < 1) { return 0; }
+            limit = std::min(limit, (size_t)allowance);
+        }
+
+        char buffer[1 << 16];
+        ssize_t length = read(master, buffer, limit);
+        if(length <= 0) { return -1; }
+
+        Clock::time_point now = Clock::now();
+        allowance -= length;
+
+        VirtualTerminal::Counts before = screen.getCounts();
+        screen.feed(buffer, length);
+        VirtualTerminal::Counts work = screen.getCounts() - before;
+
+        // Once a response has gone quiet, anything later wasn't caused by it
+        if(step != NULL && step->responded &&
+           millisecondsBetween(lastOutput, now) > options.quiet) {
+            step = NULL;
+        }
+        lastOutput = now;
+
+        if(step == NULL) {
+            otherCounts += work;
+        } else {
+            if(!step->responded) {
+                step->responded = true;
+                step->firstByte = millisecondsBetween(step->sent, now);
+            }
+            step->lastByte = millisecondsBetween(step->sent, now);
+            step->counts += work;
+        }
+
+        return length;
+    }
+
+    // Keep reading until the given time, or until the program goes away
+    bool readUntil(Clock::time_point deadline, Step * step) {
+        while(true) {
+            Clock::time_point now = Clock::now();
+            if(now >= deadline) { return true; }
+
+            // When throttled, wake up often enough to keep the bucket flowing
+            int wait = (int)millisecondsBetween(now, deadline) + 1;
+            if(options.throttle > 0) { wait = std::min(wait, 5); }
+
+            struct pollfd fd = { master, POLLIN, 0 };
+            int ready = poll(&fd, 1, wait);
+            if(ready < 0 && errno != EINTR) { return false; }
+            if(ready > 0) {
+                if(fd.revents & POLLIN) {
+                    if(drain(step) < 0) { return false; }
+                } else if(fd.revents & (POLLHUP | POLLERR)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    // Keep reading until nothing has come out for the quiet period
+    bool readUntilQuiet(Step * step, Clock::time_point limit) {
+        lastOutput = Clock::now();
+        while(Clock::now() < limit) {
+            Clock::time_point quietEnd = lastOutput + std::chrono::milliseconds(options.quiet);
+            if(Clock::now() >= quietEnd) { return true; }
+            if(!readUntil(std::min(quietEnd, limit), step)) { return false; }
+        }
+        return true;
+    }
+
+public:
+    Harness(Options & optionsIn) :
+        options(optionsIn), master(-1), child(-1), allowance(0),
+        screen(options.columns, options.lines) {}
+
+    bool start() {
+        struct winsize size = {};
+        size.ws_col = options.columns;
+        size.ws_row = options.lines;
+
+        child = forkpty(&master, NULL, NULL, &size);
+        if(child < 0) { return false; }
+
+        if(child == 0) {
+            setenv("TERM", options.term.c_str(), 1);
+            execvp(options.command[0], options.command.data());
+            _exit(127);
+        }
+
+        lastRefill = Clock::now();
+        allowance = options.throttle;
+        return true;
+    }
+
+    void run() {
+        // Let the program draw its first screen before we start typing
+        // (and for a throttled link to catch up with it)
+        Clock::time_point begin = Clock::now();
+        readUntil(begin + std::chrono::milliseconds(options.startup), NULL);
+        readUntilQuiet(NULL, Clock::now() + std::chrono::seconds(30));
+        fprintf(stdout, "startup: %zu bytes in %.0f ms\n", otherCounts.bytes,
+                millisecondsBetween(begin, Clock::now()));
+        otherCounts = VirtualTerminal::Counts();
+
+        Clock::time_point next = Clock::now();
+        for(size_t i = 0; i < options.steps.size(); i++) {
+            Step & step = options.steps[i];
+            next += std::chrono::milliseconds(step.delay);
+
+            // Anything arriving before this step belongs to the last one
+            Step * previous = (i > 0) ? &options.steps[i - 1] : NULL;
+            if(!readUntil(next, previous)) { break; }
+
+            step.sent = Clock::now();
+            if(write(master, step.keys.data(), step.keys.size()) < 0) { break; }
+
+            // The last step has nothing after it, so wait for it to finish
+            if(i + 1 == options.steps.size()) {
+                readUntilQuiet(&step, step.sent + std::chrono::seconds(5));
+            }
+        }
+    }
+
+    void stop() {
+        // Give the program a moment to exit by itself, then insist
+        for(int i = 0; i < 50; i++) {
+            if(waitpid(child, NULL, WNOHANG) == child) {
+                close(master);
+                return;
+            }
+            readUntil(Clock::now() + std::chrono::milliseconds(20), NULL);
+        }
+
+        kill(child, SIGTERM);
+        waitpid(child, NULL, 0);
+        close(master);
+    }
+
+    // Print the results, and return false if the screen didn't show what
+    // we expected it to
+    bool report() {
+        std::vector<double> first, last;
+        VirtualTerminal::Counts total;
+        fprintf(stdout, "unsolicited: %zu bytes\n\n", otherCounts.bytes);
+        fprintf(stdout, "%6s  %-12s %10s %10s %8s %8s %8s %8s %8s\n", "step", "keys",
+                "first (ms)", "last (ms)", "bytes", "text", "moves", "sgr", "erases");
+        for(size_t i = 0; i < options.steps.size(); i++) {
+            Step & step = options.steps[i];
+
+            // Show control characters so the table stays readable
+            std::string shown;
+            for(char ch : step.keys) {
+                if(ch == '\033') { shown += "\\e"; }
+                else if(ch == 0x7f) { shown += "^?"; }
+                else if((unsigned char)ch < 0x20) { shown += "^"; shown += (char)(ch + '@'); }
+                else { shown += ch; }
+            }
+
+            const VirtualTerminal::Counts & c = step.counts;
+            if(step.responded) {
+                fprintf(stdout, "%6zu  %-12s %10.3f %10.3f %8zu %8zu %8zu %8zu %8zu\n", i + 1,
+                        shown.c_str(), step.firstByte, step.lastByte,
+                        c.bytes, c.printable, c.cursorMoves, c.sgrChanges, c.erases);
+                first.push_back(step.firstByte);
+                last.push_back(step.lastByte);
+                total += c;
+            } else {
+                fprintf(stdout, "%6zu  %-12s %10s %10s %8d %8d %8d %8d %8d\n", i + 1,
+                        shown.c_str(), "-", "-", 0, 0, 0, 0, 0);
+            }
+        }
+
+        if(!first.empty()) {
+            fprintf(stdout, "%6s  %-12s %10s %10s %8zu %8zu %8zu %8zu %8zu\n", "total", "", "", "",
+                    total.bytes, total.printable, total.cursorMoves, total.sgrChanges, total.erases);
+            printPercentiles(first, last);
+        }
+
+        if(options.dumpScreen) {
+            fprintf(stdout, "\n");
+            screen.dump(stdout);
+        }
+
+        bool passed = true;
+        for(const std::string & text : options.expected) {
+            if(!screen.contains(text)) {
+                fprintf(stdout, "missing: %s\n", text.c_str());
+                passed = false;
+            }
+        }
+
+        return passed;
+    }
+
+    void printPercentiles(std::vector<double> & first, std::vector<double> & last) {
+
+        std::sort(first.begin(), first.end());
+        std::sort(last.begin(), last.end());
+        auto percentile = [](std::vector<double> & values, double p) {
+            return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+        };
+
+        fprintf(stdout, "\n%-10s %10s %10s %10s %10s\n", "", "min", "median", "p95", "max");
+        fprintf(stdout, "%-10s %10.3f %10.3f %10.3f %10.3f\n", "first",
+                first.front(), percentile(first, 0.5), percentile(first, 0.95), first.back());
+        fprintf(stdout, "%-10s %10.3f %10.3f %10.3f %10.3f\n", "last",
+                last.front(), percentile(last, 0.5), percentile(last, 0.95), last.back());
+    }
+
+};
+
+int main(int argc, char ** argv) {
+
+    Options options;
+    if(!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+
+    Harness harness(options);
+    if(!harness.start()) {
+        perror("latency: forkpty");
+        return 1;
+    }
+
+    harness.run();
+    harness.stop();
+
+    return harness.report() ? 0 : 1;
+
+}
@@ -1,5 +1,30 @@
 #include "vexes.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <signal.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
 //////////////////////////////// CONSTANTS ///////////////////////////////////
 
 // This map is used to make using attributes easier and more readable
@@ -26,7 +51,7 @@ static const std::map<std::string, int> attributes = {
 
 /////////////////////////////// DRAWING UTILS ////////////////////////////////
 
-int getAttribute(std::string name) {
+int getAttribute(const std::string & name) {
     auto iter = attributes.find(name);
     // Check if name exists, otherwise return A_NORMAL
     if(iter == attributes.end()) {
@@ -49,49 +74,44 @@ int combineAttributes(int num, ...) {
     return attr;
 }
 
+// These all draw on stdscr through the window functions, rather than with
+// move() and friends, so a VEXES_COUNT_CALLS build sees every call
 void drawCharAtPoint(char ch, Point p, WINDOW * win) {
-    if(win != NULL) {
-        wmove(win, p.y, p.x);
-        waddch(win, ch);
-    } else {
-        move(p.y, p.x);
-        addch(ch);
-    }
+    if(win == NULL) { win = stdscr; }
+    wmove(win, p.y, p.x);
+    waddch(win, ch);
 }
 
-void drawStringAtPoint(std::string text, Point p, WINDOW * win) {
-    if(win != NULL) {
-        wmove(win, p.y, p.x);
-        waddstr(win, text.c_str());
-    } else {
-        move(p.y, p.x);
-        addstr(text.c_str());
-    }
+void drawStringAtPoint(const std::string & text, Point p, WINDOW * win) {
+    drawStringAtPoint(text.c_str(), p, win);
+}
+
+void drawStringAtPoint(const char * text, Point p, WINDOW * win) {
+    if(win == NULL) { win = stdscr; }
+    wmove(win, p.y, p.x);
+    waddstr(win, text);
 }
 
-void drawCenteredStringAtPoint(std::string text, Point p, WINDOW * win) {
+void drawCenteredStringAtPoint(const std::string & text, Point p, WINDOW * win) {
     // Compute new point offset by half of string's length
     size_t offset = text.size() / 2;
     Point newPoint(p.x - offset, p.y);
     
     // Delegate to drawStringAtPoint with new point
-    drawStringAtPoint(text, newPoint, win);
+    drawStringAtPoint(text.c_str(), newPoint, win);
+}
+
+void drawCenteredStringAtPoint(const char * text, Point p, WINDOW * win) {
+    size_t offset = strlen(text) / 2;
+    drawStringAtPoint(text, Point(p.x - offset, p.y), win);
 }
 
 void setAttributes(int attr, WINDOW * win) {
-    if(win != NULL) {
-        wattron(win, attr);
-    } else {
-        attron(attr);
-    }
+    wattron((win != NULL) ? win : stdscr, attr);
 }
 
 void unsetAttributes(int attr, WINDOW * win) {
-    if(win != NULL) {
-        wattroff(win, attr);
-    } else {
-        attroff(attr);
-    }
+    wattroff((win != NULL) ? win : stdscr, attr);
 }
 
 void drawCustomHLineBetweenPoints(char ch, Point a, Point b, WINDOW * win) {
@@ -174,20 +194,12 @@ void drawBox(Box b, WINDOW * win) {
 }
 
 void fillBoxWithChar(Box b, char ch, WINDOW * win) {
+    if(win == NULL) { win = stdscr; }
     for(int y = b.ul.y; y < b.lr.y + 1; y++) {
         // Draw one line at a time to take advantage of addch()
-        if(win != NULL) {
-            wmove(win, y, b.ul.x);
-        } else {
-            move(y, b.ul.x);
-        }
-
+        wmove(win, y, b.ul.x);
         for(int x = b.ul.x; x < b.lr.x + 1; x++) {
-            if(win != NULL) {
-                waddch(win, ch);
-            } else {
-                addch(ch);
-            }
+            waddch(win, ch);
         }
     }
 }
@@ -196,254 +208,4817 @@ void clearBox(Box b, WINDOW * win) {
     fillBoxWithChar(b, ' ', win);
 }
 
-/////////////////////////////// BASE CLASSES /////////////////////////////////
+//////////////////////////////// INPUT UTILS /////////////////////////////////
 
-/* ENGINE */
+/*
+ * The InputLog is what getInput() records to and replays from. Logs start
+ * with a small header, followed by one record per key:
+ *
+ *     varint  microseconds since the previous record
+ *     varint  key code (zigzag encoded, since ERR is negative)
+ *     varint  x, y (zigzag) and button state, only for KEY_MOUSE
+ *
+ * Timeouts (ERR) are recorded too, so a replay runs the app's loop exactly
+ * as many times as the original session did.
+ */
+class InputLog {
 
-Engine::Engine() {
-    setupCursesEnvironment();
-}
+private:
+    static constexpr const char * magic = "VXIN\x01";
 
-Engine::~Engine() {
-    teardownCursesEnvironment();
-}
+    FILE * file;
+    bool recording;
+    bool realTime;
+    bool finished;
+    std::chrono::steady_clock::time_point start, last;
+    long long elapsed; // Replay position in microseconds
 
-void Engine::setupCursesEnvironment() {
-    initializeScreenVariables();
-    initializeColorPairs();
-}
+    void writeVarint(unsigned long long value) {
+        do {
+            unsigned char byte = value & 0x7f;
+            value >>= 7;
+            fputc(byte | (value ? 0x80 : 0), file);
+        } while(value);
+    }
 
-void Engine::initializeScreenVariables() {
-    initscr();		        // Begin curses mode
-    cbreak();		        // Disable line buffering
-    keypad(stdscr, TRUE);	// Enable extra keys
-    noecho();		        // Disable echoing keys to console
-    start_color();		    // Enable color mode
-    curs_set(0);		    // Set cursor to be invisible
-    timeout(50);		    // Make getch a non-blocking call
-}
+    bool readVarint(unsigned long long & value) {
+        value = 0;
+        for(int shift = 0; shift < 64; shift += 7) {
+            int byte = fgetc(file);
+            if(byte == EOF) { return false; }
+            value |= (unsigned long long)(byte & 0x7f) << shift;
+            if(!(byte & 0x80)) { return true; }
+        }
+        return false;
+    }
 
-void Engine::initializeColorPairs() {
-    int backgroundColor = -1; // Transparency
-    use_default_colors();
+    static unsigned long long zigzag(long long value) {
+        return ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+    }
 
-    init_pair(0, COLOR_BLACK, backgroundColor);
-    init_pair(1, COLOR_RED, backgroundColor);
-    init_pair(2, COLOR_GREEN, backgroundColor);
-    init_pair(3, COLOR_YELLOW, backgroundColor);
-    init_pair(4, COLOR_BLUE, backgroundColor);
-    init_pair(5, COLOR_MAGENTA, backgroundColor);
-    init_pair(6, COLOR_CYAN, backgroundColor);
-    init_pair(7, COLOR_WHITE, backgroundColor);
-}
+    static long long unzigzag(unsigned long long value) {
+        return (long long)(value >> 1) ^ -(long long)(value & 1);
+    }
 
-void Engine::teardownCursesEnvironment() {
-    endwin(); // Destroy stdscr
-}
+public:
+    InputLog(FILE * fileIn, bool recordingIn, bool realTimeIn) :
+        file(fileIn), recording(recordingIn), realTime(realTimeIn),
+        finished(false), elapsed(0) {
+        // Big buffer, so recording never waits on the disk mid-session
+        setvbuf(file, NULL, _IOFBF, 1 << 16);
+        start = last = std::chrono::steady_clock::now();
+    }
 
-/* PANEL */
-Panel::Panel(Box globalDimensionsIn, std::string titleIn) {
-    title = titleIn;
-    globalDimensions = globalDimensionsIn;
+    ~InputLog() {
+        fclose(file);
+    }
 
-    // Calculate sizes based on global dimensions
-    lines = globalDimensions.ll.y - globalDimensions.ul.y;
-    columns = globalDimensions.ur.x - globalDimensions.ul.x;
+    static InputLog * open(std::string path, bool recording, bool realTime) {
+        FILE * file = fopen(path.c_str(), recording ? "wb" : "rb");
+        if(file == NULL) { return NULL; }
 
-    // Use sizes in creating local dimensions
-    Point ul(0, 0); Point lr(columns, lines);
-    localDimensions = Box(ul, lr);
+        size_t length = strlen(magic);
+        if(recording) {
+            fwrite(magic, 1, length, file);
+        } else {
+            char header[8];
+            if(fread(header, 1, length, file) != length || memcmp(header, magic, length) != 0) {
+                fclose(file);
+                return NULL;
+            }
+        }
 
-    // Finally, create the internal window
-    setupWindow();
-}
+        return new InputLog(file, recording, realTime);
+    }
 
-Panel::~Panel() {
-    teardownWindow();
-}
+    bool isRecording() { return recording; }
+    bool isReplaying() { return !recording && !finished; }
 
-void Panel::setupWindow() {
-    win = newwin(lines + 1, columns + 1, globalDimensions.ul.y, globalDimensions.ul.x);
-}
+    void record(int key, const MEVENT * mouse) {
+        auto now = std::chrono::steady_clock::now();
+        long long delta = std::chrono::duration_cast<std::chrono::microseconds>(now - last).count();
+        last = now;
 
-void Panel::teardownWindow() {
-    delwin(win);
-}
+        writeVarint(delta);
+        writeVarint(zigzag(key));
+        // A KEY_MOUSE that getmouse() couldn't read is logged with no buttons
+        if(key == KEY_MOUSE) {
+            writeVarint(mouse != NULL ? zigzag(mouse->x) : 0);
+            writeVarint(mouse != NULL ? zigzag(mouse->y) : 0);
+            writeVarint(mouse != NULL ? mouse->bstate : 0);
+        }
+    }
 
-void Panel::drawPanel() {
-    drawBorder();
-    drawTitle();
-    refreshWindow();
-}
+    // Returns false once the log runs out
+    bool replay(int & key, MEVENT & mouse) {
+        unsigned long long delta, code, x, y, bstate;
+        if(!readVarint(delta) || !readVarint(code)) {
+            finished = true;
+            return false;
+        }
 
-void Panel::drawBorder() {
-    drawBox(localDimensions, win);
-}
+        key = (int)unzigzag(code);
+        if(key == KEY_MOUSE) {
+            if(!readVarint(x) || !readVarint(y) || !readVarint(bstate)) {
+                finished = true;
+                return false;
+            }
+            mouse = MEVENT();
+            mouse.x = (int)unzigzag(x);
+            mouse.y = (int)unzigzag(y);
+            mouse.bstate = (mmask_t)bstate;
+        }
 
-void Panel::drawTitle() {
-    Point titlePoint(columns / 2, 0);
-    drawCenteredStringAtPoint(title, titlePoint, win);
-}
+        // In real time, wait until the key arrived in the original session
+        elapsed += delta;
+        if(realTime) {
+            std::this_thread::sleep_until(start + std::chrono::microseconds(elapsed));
+        }
 
-void Panel::refreshWindow() {
-    wrefresh(win);
-}
+        return true;
+    }
 
-void Panel::resizePanel(Box newGlobalDimensions) {
-    globalDimensions = newGlobalDimensions;
-    lines = newGlobalDimensions.ll.y - newGlobalDimensions.ul.y;
-    columns = newGlobalDimensions.ur.x - newGlobalDimensions.ul.x;
+};
 
-    Point ul(0, 0); Point lr(columns, lines);
-    localDimensions = Box(ul, lr);
+// The Engine owns this, but getInput() has to work for Forms too
+static InputLog * inputLog = NULL;
 
-    replaceWindow();
-}
+/*
+ * The OutputCapture tees everything curses writes to the terminal into an
+ * asciicast v2 file. Before curses starts, stdout is swapped for a pipe; a
+ * forwarding thread copies whatever comes out of the pipe to the real
+ * terminal first, and only then queues it for a writer thread that escapes
+ * it and writes it to the capture file. Neither the app nor the forwarder
+ * ever waits on the file. curses keeps using stderr for terminal
+ * modes and sizes, since stdout is no longer a tty.
+ */
+class OutputCapture {
 
-void Panel::replaceWindow() {
-    teardownWindow();
-    setupWindow();
-}
+private:
+    // Output read from the pipe, or a resize, waiting to be written
+    struct Event {
+        double seconds;
+        char type;          // 'o' or 'r'
+        std::string data;
+    };
 
-void Panel::clearScreen() {
-    clearBox(localDimensions, win);
-}
+    int terminalFd;     // The real terminal, which stdout used to be
+    int pipeFd;         // The read end of the pipe stdout now points at
+    FILE * file;
+    std::thread forwarder;
+    std::thread writer;
+    std::mutex queueLock;
+    std::condition_variable queued;
+    std::deque<Event> events;
+    bool finished;      // Nothing more will be queued
+    std::chrono::steady_clock::time_point start;
+    std::string carry;  // Partial UTF-8 sequence left over from a read
 
-WINDOW * Panel::getWin() {
-    return win;
-}
+    OutputCapture(int terminalFdIn, int pipeFdIn, FILE * fileIn) :
+        terminalFd(terminalFdIn), pipeFd(pipeFdIn), file(fileIn), finished(false) {
+        start = std::chrono::steady_clock::now();
+        setvbuf(file, NULL, _IOFBF, 1 << 16);
+        writer = std::thread(&OutputCapture::writeEvents, this);
+        forwarder = std::thread(&OutputCapture::forward, this);
+    }
 
-void Panel::setTitle(std::string newTitle) {
-    title = newTitle;
-}
+    // asciicast strings are JSON, so escape them and keep them valid UTF-8
+    static void appendJson(std::string & out, const std::string & data, std::string & leftover) {
+        size_t i = 0;
+        while(i < data.size()) {
+            unsigned char byte = data[i];
+            if(byte < 0x80) {
+                char escaped[8];
+                switch(byte) {
+                    case '"':  out += "\\\""; break;
+                    case '\\': out += "\\\\"; break;
+                    case '\n': out += "\\n"; break;
+                    case '\r': out += "\\r"; break;
+                    case '\t': out += "\\t"; break;
+                    default:
+                        if(byte < 0x20 || byte == 0x7f) {
+                            snprintf(escaped, sizeof(escaped), "\\u%04x", byte);
+                            out += escaped;
+                        } else {
+                            out += (char)byte;
+                        }
+                        break;
+                }
+                i++;
+                continue;
+            }
 
-/* FORM */
-Form::Form(Point origin) :
-    origin(origin), prompt(""), promptLength((int)prompt.size()), buffer("") {
-    lines = 1; columns = COLS - (promptLength + 2);
-    win = newwin(lines, COLS - 1, origin.y, origin.x);
-    keypad(win, TRUE);
-}
+            size_t length = (byte >= 0xc2 && byte <= 0xdf) ? 2 :
+                            (byte >= 0xe0 && byte <= 0xef) ? 3 :
+                            (byte >= 0xf0 && byte <= 0xf4) ? 4 : 0;
 
-Form::Form(Point origin, int length) :
-    origin(origin), prompt(""), promptLength((int)prompt.size()), buffer("") {
-    lines = 1; columns = length - (promptLength + 1);
-    win = newwin(lines, length, origin.y, origin.x);
-    keypad(win, TRUE);
-}
+            // Sequences cut off by the end of a read finish in the next one
+            if(length > 0 && i + length > data.size()) {
+                bool partial = true;
+                for(size_t j = i + 1; j < data.size(); j++) {
+                    partial = partial && ((unsigned char)data[j] & 0xc0) == 0x80;
+                }
+                if(partial) {
+                    leftover = data.substr(i);
+                    return;
+                }
+            }
 
-Form::Form(Point origin, std::string prompt) :
-    origin(origin), prompt(prompt), promptLength((int)prompt.size()), buffer("") {
-    lines = 1; columns = COLS - (promptLength + 2);
-    win = newwin(lines, COLS - 1, origin.y, origin.x);
-    keypad(win, TRUE);
-}
+            bool valid = length > 0 && i + length <= data.size();
+            for(size_t j = 1; valid && j < length; j++) {
+                valid = ((unsigned char)data[i + j] & 0xc0) == 0x80;
+            }
 
-Form::Form(Point origin, int length, std::string prompt) :
-    origin(origin), prompt(prompt), promptLength((int)prompt.size()), buffer("") {
-    lines = 1; columns = length - (promptLength + 1);
-    win = newwin(lines, length, origin.y, origin.x);
-    keypad(win, TRUE);
-}
+            if(valid) {
+                out.append(data, i, length);
+                i += length;
+            } else {
+                // Stray bytes are passed along as if they were Latin-1
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", byte);
+                out += escaped;
+                i++;
+            }
+        }
+    }
 
-Form::~Form() {
-    delwin(win);
-}
+    // Stamped now, and written out by the writer thread when it gets to it
+    void queueEvent(char type, std::string data) {
+        double seconds = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
+        {
+            std::lock_guard<std::mutex> lock(queueLock);
+            events.push_back({seconds, type, std::move(data)});
+        }
+        queued.notify_one();
+    }
 
-void Form::drawForm() {
-    clearForm();
-    drawPrompt();
-    drawBuffer();
-}
+    // Escaping and writing happen here, so a slow disk never holds up the
+    // forwarder, and so never the app writing to the terminal
+    void writeEvents() {
+        std::unique_lock<std::mutex> lock(queueLock);
+        while(true) {
+            queued.wait(lock, [this]() { return finished || !events.empty(); });
+            if(events.empty()) { break; }
 
-void Form::clearForm() {
-    Point ul(promptLength + 1, 0);
-    Point lr(columns + (promptLength + 1), 0);
-    Box formBox(ul, lr);
-    clearBox(formBox, win);
-}
+            Event event = std::move(events.front());
+            events.pop_front();
+            lock.unlock();
 
-void Form::drawPrompt() {
-    Point promptPoint(0, 0);
-    drawStringAtPoint(prompt, promptPoint, win);
-}
+            if(event.type == 'r') {
+                fprintf(file, "[%.6f, \"r\", \"%s\"]\n", event.seconds, event.data.c_str());
+            } else {
+                // Only the output stream can have a sequence split across reads
+                std::string line;
+                std::string leftover;
+                appendJson(line, carry + event.data, leftover);
+                carry = leftover;
+                if(!line.empty()) {
+                    fprintf(file, "[%.6f, \"o\", \"%s\"]\n", event.seconds, line.c_str());
+                }
+            }
 
-void Form::drawBuffer() {
-    int bufferSize = (int)buffer.size();
-    std::string tempBuffer;
-    int formLength = columns;
-    if(bufferSize >= formLength) {
-        tempBuffer = buffer.substr(bufferSize - formLength, bufferSize);
-    } else {
-        tempBuffer = buffer;
+            lock.lock();
+        }
     }
 
-    Point bufferPoint(promptLength + 1, 0);
-    drawStringAtPoint(tempBuffer, bufferPoint, win); 
-}
+    void forward() {
+        char buffer[1 << 16];
+        ssize_t length;
+        while((length = read(pipeFd, buffer, sizeof(buffer))) != 0) {
+            if(length < 0) {
+                if(errno == EINTR) { continue; }
+                break;
+            }
 
-void Form::injectString(std::string str) {
-    for(char ch : str) {
-        addCharToBuffer(ch);
+            // The terminal always comes first
+            for(ssize_t written = 0; written < length; ) {
+                ssize_t result = write(terminalFd, buffer + written, length - written);
+                if(result < 0 && errno != EINTR) { break; }
+                if(result > 0) { written += result; }
+            }
+
+            queueEvent('o', std::string(buffer, length));
+        }
     }
-}
 
-void Form::addCharToBuffer(char ch) {
-    char converted[2];
-    sprintf(converted, "%c", ch);
-    std::string str = converted;
-    buffer = buffer + str;
-}
+public:
+    // Must be called before curses starts. Returns NULL if capture can't
+    // work here, like when there's no terminal on stderr for curses to use.
+    static OutputCapture * open(std::string path) {
+        if(!isatty(STDOUT_FILENO) || !isatty(STDERR_FILENO)) { return NULL; }
 
-void Form::removeCharFromBuffer() {
-    buffer = buffer.substr(0, buffer.size() - 1);
-}
+        FILE * file = fopen(path.c_str(), "w");
+        if(file == NULL) { return NULL; }
 
-std::string Form::edit() {
-    // Make cursor visible while typing
-    curs_set(1);
+        int fds[2];
+        if(pipe(fds) != 0) {
+            fclose(file);
+            return NULL;
+        }
 
-    int ch;
-    bool exit = false;
-    while(!exit) {
-        drawForm();
-        ch = wgetch(win);
-        switch(ch) {
-            case 10: // Enter Key (submit)
-            case KEY_F(1): // Cancel form input
-                exit = true;
-                break;
-            default: // Delegate to form driver
-                handleInput(ch);
-                break;
+        struct winsize size;
+        if(ioctl(STDERR_FILENO, TIOCGWINSZ, &size) != 0) {
+            size.ws_col = 80;
+            size.ws_row = 24;
         }
+        const char * term = getenv("TERM");
+        fprintf(file, "{\"version\": 2, \"width\": %d, \"height\": %d, "
+                      "\"timestamp\": %ld, \"env\": {\"TERM\": \"%s\"}}\n",
+                size.ws_col, size.ws_row, (long)time(NULL), term ? term : "");
+
+        // Swap stdout for the pipe, keeping the real terminal for ourselves
+        fflush(stdout);
+        int terminalFd = dup(STDOUT_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        fcntl(terminalFd, F_SETFD, FD_CLOEXEC);
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+        return new OutputCapture(terminalFd, fds[0], file);
     }
 
-    // Make cursor invisible after typing
-    curs_set(0);
+    // Must be called after curses has finished, so nothing is left behind
+    ~OutputCapture() {
+        // Putting stdout back closes the pipe, which stops the forwarder
+        fflush(stdout);
+        dup2(terminalFd, STDOUT_FILENO);
+        forwarder.join();
 
-    return trimWhitespace(buffer);
-}
+        // The writer finishes whatever is queued before it stops
+        {
+            std::lock_guard<std::mutex> lock(queueLock);
+            finished = true;
+        }
+        queued.notify_one();
+        writer.join();
 
-void Form::handleInput(int ch) {
-    switch(ch) {
-        case KEY_BACKSPACE:
-        case 127: // Backspace Key
-            removeCharFromBuffer();
-            break;
-        default: // Normal character
-            addCharToBuffer(ch);
-            break;
+        close(pipeFd);
+        close(terminalFd);
+        fclose(file);
+    }
+
+    void resized(int columns, int lines) {
+        char size[32];
+        snprintf(size, sizeof(size), "%dx%d", columns, lines);
+        queueEvent('r', size);
+    }
+
+};
+
+static OutputCapture * outputCapture = NULL;
+
+// Quote and escape text as a JSON string, for the reports below
+static void appendJsonString(std::string & out, const std::string & text) {
+    out += '"';
+    for(unsigned char c : text) {
+        if(c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if(c < 0x20 || c == 0x7f) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
     }
+    out += '"';
 }
 
-std::string Form::trimWhitespace(std::string str) {
-    size_t first = str.find_first_not_of(' ');
-	if(std::string::npos == first) {
-		return str;
-	}
+/*
+ * The FrameWatchdog times each frame, from getInput() waking up until the
+ * frame has been presented at the start of the next call, and charges the
+ * time to whoever spent it. drawPanel() can't be timed directly, since apps
+ * override it, so when a Panel is refreshed it's charged with everything
+ * since the watchdog last looked. Input handlers mark where they finish
+ * with Engine::chargeFrameTime() the same way, so their work isn't charged
+ * to the first Panel drawn after. Timers and presenting are timed around
+ * the calls.
+ */
+class FrameWatchdog {
 
-	size_t last = str.find_last_not_of(' ');
+private:
+    typedef std::chrono::steady_clock Clock;
 
-	return str.substr(first, (last - first + 1));
+    struct Charge {
+        std::string name;
+        Point origin;           // Panels only
+        Clock::duration time;
+    };
+
+    FILE * file;
+    Clock::duration budget;
+    Clock::duration interval;
+    Clock::time_point start;
+    Clock::time_point checkpoint;   // Last time anyone was charged
+    Clock::time_point lastReport;
+    bool running;
+    bool reported;
+    int key;
+    std::vector<Charge> handlers;
+    std::vector<Charge> panels;
+    std::vector<Charge> timers;
+    Clock::duration present;
+    int suppressed;                 // Slow frames since the last report
+
+    FrameWatchdog(FILE * fileIn, int budgetMs, int intervalMs) :
+        file(fileIn), budget(std::chrono::milliseconds(budgetMs)),
+        interval(std::chrono::milliseconds(intervalMs)), running(false),
+        reported(false), key(ERR), present(0), suppressed(0) {}
+
+    static double milliseconds(Clock::duration time) {
+        return std::chrono::duration<double, std::milli>(time).count();
+    }
+
+    static void appendCharges(std::string & out, std::vector<Charge> & charges, bool panel) {
+        std::sort(charges.begin(), charges.end(),
+                  [](const Charge & a, const Charge & b) { return a.time > b.time; });
+
+        out += '[';
+        for(size_t i = 0; i < charges.size(); i++) {
+            char number[64];
+            out += (i > 0) ? ", {" : "{";
+            out += panel ? "\"title\": " : "\"name\": ";
+            appendJsonString(out, charges[i].name);
+            if(panel) {
+                snprintf(number, sizeof(number), ", \"x\": %d, \"y\": %d",
+                         charges[i].origin.x, charges[i].origin.y);
+                out += number;
+            }
+            snprintf(number, sizeof(number), ", \"ms\": %.3f}", milliseconds(charges[i].time));
+            out += number;
+        }
+        out += ']';
+    }
+
+    // A Panel drawn twice in one frame is only listed once
+    static void charge(std::vector<Charge> & charges, const std::string & name,
+                       Point origin, Clock::duration time) {
+        for(Charge & existing : charges) {
+            if(existing.name == name && existing.origin.x == origin.x &&
+               existing.origin.y == origin.y) {
+                existing.time += time;
+                return;
+            }
+        }
+        charges.push_back({name, origin, time});
+    }
+
+    void report(Clock::duration total) {
+        Clock::duration spent = present;
+        for(const Charge & c : handlers) { spent += c.time; }
+        for(const Charge & c : panels) { spent += c.time; }
+        for(const Charge & c : timers) { spent += c.time; }
+
+        char number[160];
+        double now = std::chrono::duration<double>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        snprintf(number, sizeof(number),
+                 "{\"time\": %.3f, \"frame_ms\": %.3f, \"budget_ms\": %.3f, \"key\": ",
+                 now, milliseconds(total), milliseconds(budget));
+        std::string line = number;
+
+        const char * name = (key != ERR) ? keyname(key) : NULL;
+        if(name != NULL) {
+            appendJsonString(line, name);
+        } else {
+            line += "null";
+        }
+
+        line += ", \"handlers\": ";
+        appendCharges(line, handlers, false);
+        line += ", \"panels\": ";
+        appendCharges(line, panels, true);
+        line += ", \"timers\": ";
+        appendCharges(line, timers, false);
+
+        // Anything nobody claimed, like work after the last Panel was drawn
+        snprintf(number, sizeof(number), ", \"present_ms\": %.3f, \"other_ms\": %.3f, \"suppressed\": %d}\n",
+                 milliseconds(present), milliseconds(std::max(total - spent, Clock::duration(0))),
+                 suppressed);
+        line += number;
+
+        fputs(line.c_str(), file);
+        fflush(file);
+    }
+
+public:
+    // Returns NULL if the report file can't be opened
+    static FrameWatchdog * open(std::string path, int budgetMs, int intervalMs) {
+        FILE * file = fopen(path.c_str(), "a");
+        if(file == NULL) { return NULL; }
+
+        return new FrameWatchdog(file, budgetMs, std::max(intervalMs, 0));
+    }
+
+    ~FrameWatchdog() {
+        fclose(file);
+    }
+
+    // getInput() has stopped waiting, so everything from here is the frame's
+    void beginFrame(int keyIn) {
+        start = checkpoint = Clock::now();
+        running = true;
+        key = keyIn;
+        handlers.clear();
+        panels.clear();
+        timers.clear();
+        present = Clock::duration(0);
+    }
+
+    void chargeHandler(const std::string & name) {
+        if(!running) { return; }
+
+        Clock::time_point now = Clock::now();
+        charge(handlers, name, Point(), now - checkpoint);
+        checkpoint = now;
+    }
+
+    void chargePanel(const std::string & title, Point origin) {
+        if(!running) { return; }
+
+        Clock::time_point now = Clock::now();
+        charge(panels, title.empty() ? "(untitled)" : title, origin, now - checkpoint);
+        checkpoint = now;
+    }
+
+    void chargeTimer(const std::string & name, Clock::time_point began) {
+        if(!running) { return; }
+
+        Clock::time_point now = Clock::now();
+        charge(timers, name, Point(), now - began);
+        checkpoint = now;
+    }
+
+    void chargePresent(Clock::time_point began) {
+        if(!running) { return; }
+
+        Clock::time_point now = Clock::now();
+        present += now - began;
+        checkpoint = now;
+    }
+
+    // The frame is out, so see whether it was over budget
+    void endFrame() {
+        if(!running) { return; }
+        running = false;
+
+        Clock::time_point now = Clock::now();
+        Clock::duration total = now - start;
+        if(total <= budget) { return; }
+
+        if(reported && now - lastReport < interval) {
+            suppressed++;
+            return;
+        }
+
+        report(total);
+        reported = true;
+        lastReport = now;
+        suppressed = 0;
+    }
+
+};
+
+static FrameWatchdog * frameWatchdog = NULL;
+
+struct TerminalState;
+
+/*
+ * The FrameMetrics fill in the Histograms behind Engine::getFrameTimes() and
+ * friends. Frames and Panels are timed the same way the FrameWatchdog does
+ * it. Flush bytes are whatever the direct backend says it wrote; curses
+ * writes its frames straight to the terminal's descriptor, past any stream
+ * we could count them through, so they're left out there.
+ *
+ * A key is counted from when it came in, as near as we can tell, up to when
+ * the frame drawn for it has gone out. If nothing was waiting when getInput()
+ * went to sleep, the key came in when it woke up. Otherwise it came in while
+ * the app was busy, and the best we know is that there's been something
+ * waiting since the last time getInput() did have to sleep.
+ */
+class FrameMetrics {
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    Clock::time_point start;
+    Clock::time_point checkpoint;   // Last time anyone was charged
+    bool running;
+    Clock::time_point keyArrived;
+    TerminalState * keyTerminal;    // Owes output for a key, or NULL
+    bool slept;                     // Nothing was waiting at the last wait
+    Clock::time_point lastSlept;    // When getInput() last woke up from sleep
+
+    static unsigned long long microseconds(Clock::duration time) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(time).count();
+    }
+
+public:
+    Histogram frameTimes;
+    Histogram inputLatencies;
+    Histogram flushBytes;
+    std::map<std::string, Histogram> panelDrawTimes;
+
+    FrameMetrics() : running(false), keyTerminal(NULL), slept(true) {
+        lastSlept = Clock::now();
+    }
+
+    // getInput() is about to wait, with keys already there or not
+    void beginWait(bool keysWaiting) {
+        slept = !keysWaiting;
+    }
+
+    // A key that's still waiting for output keeps its place, so the wait
+    // is counted from whichever came first
+    void beginFrame(int key, TerminalState * source) {
+        start = checkpoint = Clock::now();
+        running = true;
+        if(slept) {
+            lastSlept = start;
+        }
+        if(key != ERR && keyTerminal == NULL) {
+            keyArrived = lastSlept;
+            keyTerminal = source;
+        }
+    }
+
+    // Someone other than a Panel was charged, so Panels count from here
+    void moveCheckpoint() {
+        checkpoint = Clock::now();
+    }
+
+    void chargePanel(const std::string & title) {
+        if(!running) { return; }
+
+        static const std::string untitled = "(untitled)";
+        Clock::time_point now = Clock::now();
+        panelDrawTimes[title.empty() ? untitled : title].record(microseconds(now - checkpoint));
+        checkpoint = now;
+    }
+
+    // A frame went out to state, taking written bytes, or -1 if we can't
+    // tell. A key owed output from it has had it now.
+    void flushed(TerminalState * state, long long written) {
+        if(written > 0) {
+            flushBytes.record(written);
+        }
+        if(keyTerminal != NULL && keyTerminal == state) {
+            inputLatencies.record(microseconds(Clock::now() - keyArrived));
+            keyTerminal = NULL;
+        }
+    }
+
+    void endFrame() {
+        if(!running) { return; }
+        running = false;
+
+        frameTimes.record(microseconds(Clock::now() - start));
+    }
+
+    void reset() {
+        frameTimes.reset();
+        inputLatencies.reset();
+        flushBytes.reset();
+        panelDrawTimes.clear();
+    }
+
+};
+
+static FrameMetrics * frameMetrics = NULL;
+
+/*
+ * The MetricsSocket listens on a Unix socket for scrapers. Each one that
+ * connects is sent Engine::formatMetrics() and hung up on, without waiting
+ * for it to ask. It's watched like any other fd, but never wakes the app.
+ */
+class MetricsSocket {
+
+private:
+    static const int sendTimeoutMs = 100;  // Don't let a stuck scraper stall frames
+
+    int fd;
+    std::string path;
+
+    MetricsSocket(int fdIn, const std::string & pathIn) : fd(fdIn), path(pathIn) {}
+
+public:
+    // Returns NULL if the socket can't be made at path
+    static MetricsSocket * open(const std::string & path) {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if(path.empty() || path.size() >= sizeof(address.sun_path)) { return NULL; }
+        memcpy(address.sun_path, path.data(), path.size());
+
+        // A socket left behind by an earlier run is in the way, but
+        // anything else at path is left alone
+        struct stat info;
+        if(lstat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+            unlink(path.c_str());
+        }
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(fd < 0) { return NULL; }
+        if(bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, 4) != 0) {
+            close(fd);
+            return NULL;
+        }
+        return new MetricsSocket(fd, path);
+    }
+
+    ~MetricsSocket() {
+        close(fd);
+        unlink(path.c_str());
+    }
+
+    int getFd() {
+        return fd;
+    }
+
+    // Answer everyone waiting to connect
+    void serve() {
+        int client;
+        while((client = accept4(fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+            struct timeval timeout = { 0, sendTimeoutMs * 1000 };
+            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+            std::string text = Engine::formatMetrics();
+            size_t sent = 0;
+            while(sent < text.size()) {
+                ssize_t result = send(client, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+                if(result < 0 && errno == EINTR) { continue; }
+                if(result <= 0) { break; }
+                sent += result;
+            }
+            close(client);
+        }
+    }
+
+};
+
+const int MetricsSocket::sendTimeoutMs;
+
+static MetricsSocket * metricsSocket = NULL;
+
+#ifdef VEXES_COUNT_ALLOCATIONS
+/*
+ * Built with VEXES_COUNT_ALLOCATIONS (make COUNT_ALLOCATIONS=1), every
+ * operator new is counted, per thread, so the OutputCapture's forwarder
+ * doesn't get mixed in with the app. The AllocationLog then writes how many
+ * each frame made to VEXES_ALLOCATION_LOG, as one line of JSON per frame,
+ * using the same frames as the FrameWatchdog. Once an app has settled into
+ * doing the same thing over and over, its frames should make none at all.
+ */
+static thread_local unsigned long allocationCount = 0;
+
+void * operator new(size_t size) {
+    allocationCount++;
+    void * memory = malloc(size > 0 ? size : 1);
+    if(memory == NULL) { throw std::bad_alloc(); }
+    return memory;
+}
+
+void * operator new[](size_t size) {
+    return ::operator new(size);
+}
+
+void * operator new(size_t size, const std::nothrow_t &) noexcept {
+    allocationCount++;
+    return malloc(size > 0 ? size : 1);
+}
+
+void * operator new[](size_t size, const std::nothrow_t & tag) noexcept {
+    return ::operator new(size, tag);
+}
+
+void operator delete(void * memory) noexcept { free(memory); }
+void operator delete[](void * memory) noexcept { free(memory); }
+void operator delete(void * memory, size_t) noexcept { free(memory); }
+void operator delete[](void * memory, size_t) noexcept { free(memory); }
+
+class AllocationLog {
+
+private:
+    FILE * file;
+    unsigned long frame;
+    unsigned long start;    // allocationCount when the frame began
+    int key;
+    bool running;
+    bool waiting;           // start was taken when the last frame ended
+
+    AllocationLog(FILE * fileIn) :
+        file(fileIn), frame(0), start(0), key(ERR), running(false), waiting(false) {}
+
+public:
+    static AllocationLog * open(const char * path) {
+        FILE * file = fopen(path, "w");
+        return (file != NULL) ? new AllocationLog(file) : NULL;
+    }
+
+    ~AllocationLog() {
+        fclose(file);
+    }
+
+    // What getInput() allocates while waiting is put down to the frame
+    // the wait ends with, so the count runs on from the last frame's end
+    void beginFrame(int keyIn) {
+        if(!waiting) {
+            start = allocationCount;
+        }
+        waiting = false;
+        key = keyIn;
+        running = true;
+    }
+
+    void endFrame() {
+        if(!running) { return; }
+        running = false;
+
+        // Count before building the line, which allocates too
+        unsigned long allocations = allocationCount - start;
+
+        std::string name = "null";
+        const char * keyName = (key != ERR) ? keyname(key) : NULL;
+        if(keyName != NULL) {
+            name.clear();
+            appendJsonString(name, keyName);
+        }
+        fprintf(file, "{\"frame\": %lu, \"key\": %s, \"allocations\": %lu}\n",
+                ++frame, name.c_str(), allocations);
+
+        // Harnesses tend to kill the app rather than ask it to quit
+        fflush(file);
+
+        start = allocationCount;
+        waiting = true;
+    }
+
+};
+
+static AllocationLog * allocationLog = NULL;
+#endif
+
+// Terminals that support DEC mode 2026 hold off drawing anything between
+// these, so a frame shows up all at once instead of in pieces
+static const char beginSynchronizedUpdate[] = "\033[?2026h";
+static const char endSynchronizedUpdate[] = "\033[?2026l";
+
+// Low bandwidth mode, and the link speed it plans frames around
+static bool lowBandwidth = false;
+static int lowBandwidthBytesPerSecond = 0;
+
+// Map any colour onto the basic eight, which need the shortest sequences
+// and survive any terminal
+static short basicColor(short color) {
+    if(color < 8) { return color; }
+    if(color < 16) { return color - 8; }
+    if(color >= 232) { return (color >= 244) ? COLOR_WHITE : COLOR_BLACK; }
+
+    // The 6x6x6 colour cube, where each channel is either on or off
+    int cube = color - 16;
+    return ((cube / 36 >= 3) ? COLOR_RED : 0) |
+           ((cube / 6 % 6 >= 3) ? COLOR_GREEN : 0) |
+           ((cube % 6 >= 3) ? COLOR_BLUE : 0);
+}
+
+// What curses holds for a window: the WINDOW, an entry in its line table
+// (a cell pointer and three shorts) for each line, and a cell for each
+// character, unless it shares them with the window it's part of. Wide
+// character builds of curses use bigger cells, so it's only a guide.
+static size_t windowMemoryUsage(WINDOW * win) {
+    if(win == NULL) { return 0; }
+
+    size_t lines = std::max(getmaxy(win), 0);
+    size_t columns = std::max(getmaxx(win), 0);
+    size_t usage = sizeof(WINDOW) + lines * 2 * sizeof(void *);
+    if(!is_subwin(win)) {
+        usage += lines * columns * sizeof(chtype);
+    }
+    return usage;
+}
+
+// What a string holds on the heap, which short ones don't need at all
+static size_t stringMemoryUsage(const std::string & text) {
+    const char * inside = (const char *)&text;
+    bool local = text.data() >= inside && text.data() < inside + sizeof(text);
+    return local ? 0 : text.capacity() + 1;
+}
+
+/*
+ * The DirectOutput backend takes over the job of doupdate(). Drawing still
+ * goes into curses windows, and wnoutrefresh() still builds the next frame
+ * in newscr, but instead of letting curses send it, we diff it against
+ * curscr ourselves, build the escape sequences for every changed line, and
+ * hand the lot to the terminal with a single writev(). Afterwards curscr is
+ * brought up to date, so curses' own idea of the screen stays correct.
+ *
+ * It speaks ECMA-48/xterm sequences directly, so it's only used when the
+ * terminal's cursor addressing looks like one.
+ */
+class DirectOutput {
+
+private:
+    // Attributes we know how to turn on and off, and their SGR codes
+    static const attr_t styleMask = A_BOLD | A_DIM | A_UNDERLINE | A_BLINK |
+                                    A_REVERSE | A_STANDOUT | A_INVIS;
+
+    struct Scroll { int top, bottom, lines; };
+
+    FILE * output;                       // The terminal's stream, and its fd
+    int outputFd;
+    std::string head;                    // Clears and scrolls, sent first
+    std::vector<std::string> rows;       // Output for each line of the frame
+    std::vector<struct iovec> segments;
+    std::vector<chtype> nextRow, lastRow;
+    std::string changes;
+
+    // What we believe the terminal is doing right now
+    int cursorY, cursorX;
+    bool cursorKnown;
+    attr_t attrs;                        // Style and color pair
+    bool alternate;                      // Line drawing characters are on
+    int screenLines, screenColumns;
+
+    bool canScroll;                      // The terminal has scroll regions
+    std::vector<Scroll> scrolls;         // Panels scrolled since last frame
+
+    static bool isBlank(chtype ch) {
+        return (ch & (A_CHARTEXT | A_ATTRIBUTES)) == ' ';
+    }
+
+    static void appendNumber(std::string & out, int n) {
+        char digits[12];
+        int length = snprintf(digits, sizeof(digits), "%d", n);
+        out.append(digits, length);
+    }
+
+    static void appendColor(std::string & out, short color, int base) {
+        if(!out.empty()) { out += ';'; }
+        if(lowBandwidth) { color = basicColor(color); }
+        if(color < 0) { appendNumber(out, base + 9); }
+        else if(color < 8) { appendNumber(out, base + color); }
+        else if(color < 16) { appendNumber(out, base + 60 + color - 8); }
+        else {
+            appendNumber(out, base + 8);
+            out += ";5;";
+            appendNumber(out, color);
+        }
+    }
+
+    static void appendCode(std::string & out, int code) {
+        if(!out.empty()) { out += ';'; }
+        appendNumber(out, code);
+    }
+
+    // Parameters that turn the attributes in 'on' on, and nothing else
+    static void appendStyleOn(std::string & out, attr_t on) {
+        if(on & A_BOLD) { appendCode(out, 1); }
+        if(on & A_DIM) { appendCode(out, 2); }
+        if(on & A_UNDERLINE) { appendCode(out, 4); }
+        if(on & A_BLINK) { appendCode(out, 5); }
+        if(on & (A_REVERSE | A_STANDOUT)) { appendCode(out, 7); }
+        if(on & A_INVIS) { appendCode(out, 8); }
+    }
+
+    // Change attributes with whichever is shorter: switching just the ones
+    // that differ, or resetting and building the new set from scratch
+    void setAttributes(std::string & out, attr_t next) {
+        attr_t from = attrs & (styleMask | A_COLOR);
+        attr_t to = next & (styleMask | A_COLOR);
+        if(from == to) { return; }
+
+        short fromFg, fromBg, toFg, toBg;
+        pair_content(PAIR_NUMBER(from), &fromFg, &fromBg);
+        pair_content(PAIR_NUMBER(to), &toFg, &toBg);
+
+        changes.clear();
+        attr_t off = from & ~to;
+        attr_t on = to & ~from & styleMask;
+        if(off & (A_BOLD | A_DIM)) {
+            appendCode(changes, 22);
+            on |= to & (A_BOLD | A_DIM);
+        }
+        if(off & A_UNDERLINE) { appendCode(changes, 24); }
+        if(off & A_BLINK) { appendCode(changes, 25); }
+        if((off & (A_REVERSE | A_STANDOUT)) && !(to & (A_REVERSE | A_STANDOUT))) {
+            appendCode(changes, 27);
+        }
+        if(off & A_INVIS) { appendCode(changes, 28); }
+        appendStyleOn(changes, on);
+        if(fromFg != toFg) { appendColor(changes, toFg, 30); }
+        if(fromBg != toBg) { appendColor(changes, toBg, 40); }
+
+        std::string fresh = "0";
+        appendStyleOn(fresh, to & styleMask);
+        if(toFg >= 0) { appendColor(fresh, toFg, 30); }
+        if(toBg >= 0) { appendColor(fresh, toBg, 40); }
+
+        out += "\033[";
+        out += (fresh.size() < changes.size()) ? fresh : changes;
+        out += 'm';
+        attrs = to;
+    }
+
+    void setAlternate(std::string & out, bool on) {
+        if(on == alternate) { return; }
+        out += on ? "\033(0" : "\033(B";
+        alternate = on;
+    }
+
+    // Can we get from the cursor to x by just printing the cells in between?
+    bool canReprint(int x) {
+        if(!cursorKnown || x <= cursorX || x - cursorX > 4) { return false; }
+        for(int i = cursorX; i < x; i++) {
+            chtype ch = nextRow[i];
+            if((ch & (styleMask | A_COLOR)) != (attrs & (styleMask | A_COLOR)) ||
+               ((ch & A_ALTCHARSET) != 0) != alternate) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Append the shortest way we know to move between columns on a line
+    void appendColumnMove(std::string & out, int from, int to) {
+        if(from == to) { return; }
+        if(to == 0) { out += '\r'; return; }
+
+        int distance = (to > from) ? to - from : from - to;
+        if(to < from && distance <= 2) {
+            out.append(distance, '\b');
+            return;
+        }
+
+        std::string relative = "\033[";
+        if(distance > 1) { appendNumber(relative, distance); }
+        relative += (to > from) ? 'C' : 'D';
+
+        std::string absolute = "\033[";
+        appendNumber(absolute, to + 1);
+        absolute += 'G';
+
+        out += (relative.size() <= absolute.size()) ? relative : absolute;
+    }
+
+    // Move the cursor the cheapest way. Reprinting is only possible when
+    // nextRow holds the line we're moving along.
+    void moveTo(std::string & out, int y, int x, bool reprint = true) {
+        if(cursorKnown && cursorY == y && cursorX == x) { return; }
+
+        if(reprint && y == cursorY && canReprint(x)) {
+            for(int i = cursorX; i < x; i++) {
+                out += (char)(nextRow[i] & A_CHARTEXT);
+            }
+            cursorX = x;
+            return;
+        }
+
+        std::string absolute = "\033[";
+        if(y > 0 || x > 0) { appendNumber(absolute, y + 1); }
+        if(x > 0) { absolute += ';'; appendNumber(absolute, x + 1); }
+        absolute += 'H';
+
+        if(cursorKnown) {
+            std::string relative;
+            if(y != cursorY) {
+                int distance = (y > cursorY) ? y - cursorY : cursorY - y;
+                relative = "\033[";
+                if(distance > 1) { appendNumber(relative, distance); }
+                relative += (y > cursorY) ? 'B' : 'A';
+            }
+            appendColumnMove(relative, cursorX, x);
+            if(relative.size() < absolute.size()) { absolute = relative; }
+        }
+
+        out += absolute;
+        cursorY = y;
+        cursorX = x;
+        cursorKnown = true;
+    }
+
+    void put(std::string & out, chtype ch) {
+        setAttributes(out, ch);
+        setAlternate(out, ch & A_ALTCHARSET);
+        out += (char)(ch & A_CHARTEXT);
+        cursorX++;
+
+        // Terminals disagree about where the cursor is after the last
+        // column, so we stop guessing
+        if(cursorX >= screenColumns) { cursorKnown = false; }
+    }
+
+    // Build the output that turns the last frame's line y into the next's
+    void drawRow(std::string & out, int y) {
+        int first = 0;
+        while(first < screenColumns && nextRow[first] == lastRow[first]) { first++; }
+        if(first == screenColumns) { return; }
+
+        int last = screenColumns - 1;
+        while(nextRow[last] == lastRow[last]) { last--; }
+
+        // If the line ends in blanks, and enough of them changed, they can be
+        // cleared in one go rather than printed
+        int lastText = screenColumns - 1;
+        while(lastText >= 0 && isBlank(nextRow[lastText])) { lastText--; }
+        int tail = std::max(lastText + 1, first);
+        bool clearTail = last - tail >= 3;
+        int end = clearTail ? tail - 1 : last;
+
+        for(int x = first; x <= end; x++) {
+            if(nextRow[x] == lastRow[x]) { continue; }
+            moveTo(out, y, x);
+            put(out, nextRow[x]);
+        }
+
+        if(clearTail) {
+            moveTo(out, y, tail);
+            setAttributes(out, A_NORMAL);
+            out += "\033[K";
+        }
+    }
+
+    // Scroll part of the terminal, and move the lines of curscr to match,
+    // so the diff only finds the lines that scrolled in
+    void applyScroll(const Scroll & scroll) {
+        setAttributes(head, A_NORMAL);
+        setAlternate(head, false);
+
+        int count = (scroll.lines > 0) ? scroll.lines : -scroll.lines;
+        head += "\033[";
+        appendNumber(head, scroll.top + 1);
+        head += ';';
+        appendNumber(head, scroll.bottom + 1);
+        head += "r\033[";
+        if(count > 1) { appendNumber(head, count); }
+        head += (scroll.lines > 0) ? 'S' : 'T';
+        head += "\033[r";
+
+        // Setting the scroll region sends the cursor home
+        cursorY = cursorX = 0;
+        cursorKnown = true;
+
+        wsetscrreg(curscr, scroll.top, scroll.bottom);
+        scrollok(curscr, TRUE);
+        wscrl(curscr, scroll.lines);
+        scrollok(curscr, FALSE);
+        wsetscrreg(curscr, 0, screenLines - 1);
+    }
+
+    // Returns how many bytes went out
+    size_t writeFrame(bool synchronized) {
+        segments.clear();
+        if(synchronized) {
+            struct iovec begin = { (void *)beginSynchronizedUpdate,
+                                   sizeof(beginSynchronizedUpdate) - 1 };
+            segments.push_back(begin);
+        }
+        size_t framing = segments.size();
+
+        if(!head.empty()) {
+            struct iovec segment = { (void *)head.data(), head.size() };
+            segments.push_back(segment);
+        }
+
+        for(std::string & row : rows) {
+            if(row.empty()) { continue; }
+            struct iovec segment = { (void *)row.data(), row.size() };
+            segments.push_back(segment);
+        }
+        if(segments.size() == framing) { return 0; }
+
+        if(synchronized) {
+            struct iovec end = { (void *)endSynchronizedUpdate,
+                                 sizeof(endSynchronizedUpdate) - 1 };
+            segments.push_back(end);
+        }
+
+        // One writev() for the whole frame, picking up after partial writes
+        fflush(output);
+        size_t next = 0;
+        size_t total = 0;
+        while(next < segments.size()) {
+            ssize_t written = writev(outputFd, &segments[next],
+                                     std::min(segments.size() - next, (size_t)IOV_MAX));
+            if(written < 0) {
+                if(errno == EINTR) { continue; }
+                break;
+            }
+            total += written;
+            while(next < segments.size() && (size_t)written >= segments[next].iov_len) {
+                written -= segments[next].iov_len;
+                next++;
+            }
+            if(next < segments.size()) {
+                segments[next].iov_base = (char *)segments[next].iov_base + written;
+                segments[next].iov_len -= written;
+            }
+        }
+        return total;
+    }
+
+public:
+    DirectOutput(FILE * outputIn) :
+        output(outputIn), outputFd(fileno(outputIn)), cursorY(0), cursorX(0), cursorKnown(false), attrs(A_NORMAL), alternate(false),
+        screenLines(0), screenColumns(0) {
+        const char * csr = tigetstr("csr");
+        canScroll = csr != NULL && csr != (char *)-1;
+    }
+
+    // The direct backend only knows ANSI sequences, so check the terminal
+    // uses them before we trust it with the screen
+    static bool supported() {
+        const char * cup = tigetstr("cup");
+        return cup != NULL && cup != (char *)-1 && strncmp(cup, "\033[", 2) == 0;
+    }
+
+    // Everything kept between frames, including the diffing buffers
+    size_t getMemoryUsage() {
+        size_t usage = sizeof(*this) + stringMemoryUsage(head) + stringMemoryUsage(changes);
+        usage += rows.capacity() * sizeof(std::string);
+        for(const std::string & row : rows) {
+            usage += stringMemoryUsage(row);
+        }
+        usage += segments.capacity() * sizeof(struct iovec);
+        usage += (nextRow.capacity() + lastRow.capacity()) * sizeof(chtype);
+        usage += scrolls.capacity() * sizeof(Scroll);
+        return usage;
+    }
+
+    // Note that lines top to bottom of the screen were scrolled by n (up,
+    // when positive), so the terminal can do the same at the next frame
+    void scrolled(int top, int bottom, int n) {
+        if(canScroll) {
+            scrolls.push_back({top, bottom, n});
+        }
+    }
+
+    // Send the frame, wrapped in a synchronized update if asked. Returns how
+    // many bytes it took.
+    size_t present(bool synchronized) {
+        bool redraw = is_cleared(curscr) || is_cleared(newscr) ||
+                      screenLines != LINES || screenColumns != COLS;
+        int finalY = getcury(newscr);
+        int finalX = getcurx(newscr);
+
+        if(screenLines != LINES || screenColumns != COLS) {
+            screenLines = LINES;
+            screenColumns = COLS;
+            rows.resize(screenLines + 1);
+            nextRow.resize(screenColumns + 1);
+            lastRow.resize(screenColumns + 1);
+        }
+
+        head.clear();
+        for(std::string & row : rows) { row.clear(); }
+
+        if(redraw) {
+            setAttributes(head, A_NORMAL);
+            setAlternate(head, false);
+            head += "\033[H\033[2J";
+            cursorY = cursorX = 0;
+            cursorKnown = true;
+            werase(curscr);
+            clearok(curscr, FALSE);
+            clearok(newscr, FALSE);
+        }
+
+        // Scrolled lines have to be checked even if newscr didn't change
+        int scrolledTop = screenLines, scrolledBottom = -1;
+        for(const Scroll & scroll : scrolls) {
+            if(redraw || scroll.bottom >= screenLines) { continue; }
+            applyScroll(scroll);
+            scrolledTop = std::min(scrolledTop, scroll.top);
+            scrolledBottom = std::max(scrolledBottom, scroll.bottom);
+        }
+        scrolls.clear();
+
+        for(int y = 0; y < screenLines; y++) {
+            if(!redraw && !is_linetouched(newscr, y) &&
+               (y < scrolledTop || y > scrolledBottom)) {
+                continue;
+            }
+
+            mvwinchnstr(newscr, y, 0, nextRow.data(), screenColumns);
+            mvwinchnstr(curscr, y, 0, lastRow.data(), screenColumns);
+            drawRow(rows[y], y);
+            copywin(newscr, curscr, y, 0, y, 0, y, screenColumns - 1, FALSE);
+        }
+
+        // Leave the terminal as curses expects to find it, with the cursor
+        // wherever the last refreshed window left it
+        std::string & tail = rows[screenLines];
+        setAttributes(tail, A_NORMAL);
+        setAlternate(tail, false);
+        if(!is_leaveok(newscr)) {
+            moveTo(tail, finalY, finalX, false);
+        }
+        wmove(newscr, finalY, finalX);
+        wtouchln(newscr, 0, screenLines, 0);
+
+        return writeFrame(synchronized);
+    }
+
+};
+
+/*
+ * The FramePacer watches how hard it is to get frames out to the terminal,
+ * and spaces them out when the link can't keep up. Frames it holds back
+ * aren't lost: everything drawn stays in newscr, so the next frame that
+ * does go out shows the latest state, and the ones in between are simply
+ * skipped. Backpressure shows up as bytes still queued on the tty (where
+ * TIOCOUTQ works; ptys always say 0), the output not being writable, or a
+ * write that had to wait for the link to drain.
+ *
+ * A minimum interval caps the frame rate outright, which also coalesces
+ * any small updates made in between into one larger frame.
+ */
+class FramePacer {
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    static const int congestedWriteMs = 4;  // A write this slow had to wait
+    static const int maximumIntervalMs = 500;
+
+    int fd;                                 // The terminal's output
+    int minimum;                            // Never go faster than this
+    bool adaptive;                          // Back off on congestion
+    int interval;                           // Milliseconds between frames
+    Clock::time_point lastFrame;
+
+    static int millisecondsSince(Clock::time_point then) {
+        return (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                Clock::now() - then).count();
+    }
+
+    bool congested() {
+        int queued = 0;
+        if(ioctl(fd, TIOCOUTQ, &queued) == 0 && queued > 0) {
+            return true;
+        }
+
+        struct pollfd output = { fd, POLLOUT, 0 };
+        return poll(&output, 1, 0) == 0;
+    }
+
+    void slowDown(int floor) {
+        interval = std::min(std::max(std::max(interval * 2, floor), 16),
+                            std::max(maximumIntervalMs, minimum));
+    }
+
+public:
+    FramePacer(int fdIn, int minimumIn, bool adaptiveIn) :
+        fd(fdIn), minimum(minimumIn), adaptive(adaptiveIn), interval(minimumIn), lastFrame(Clock::now()) {}
+
+    // Whether a frame can go out now. If not, it's tried again later.
+    bool ready() {
+        if(interval > 0 && millisecondsSince(lastFrame) < interval) {
+            return false;
+        }
+        if(adaptive && congested()) {
+            slowDown(interval);
+            lastFrame = Clock::now();
+            return false;
+        }
+        return true;
+    }
+
+    // How long until a held back frame is worth trying again
+    int untilReady() {
+        return std::max(interval - millisecondsSince(lastFrame), 1);
+    }
+
+    // Called after each frame is written, with when the write started
+    void presented(Clock::time_point started) {
+        int writeTime = millisecondsSince(started);
+        lastFrame = Clock::now();
+        if(!adaptive) { return; }
+
+        if(writeTime >= congestedWriteMs) {
+            slowDown(writeTime * 2);
+        } else if(interval > minimum) {
+            // The link kept up, so creep back towards full speed
+            interval = (interval * 3) / 4;
+            if(interval < 8) { interval = 0; }
+            interval = std::max(interval, minimum);
+        }
+    }
+
+    int getInterval() {
+        return interval;
+    }
+
+};
+
+const int FramePacer::congestedWriteMs;
+const int FramePacer::maximumIntervalMs;
+
+/*
+ * Everything kept for each terminal the Engine draws to. The first is the
+ * one the app was started in, and Engine::openTerminal() adds more. Each
+ * has its own SCREEN, backend and FramePacer, so a slow terminal only holds
+ * back its own frames.
+ */
+struct TerminalState {
+
+    SCREEN * screen;
+    FILE * output;
+    FILE * input;
+    DirectOutput * directOutput;    // NULL on the curses backend
+    WINDOW * inputPad;              // Keys are read from here when needed
+    WINDOW * placeholder;           // Stands in for Panels without a window
+    std::vector<WINDOW *> synced;   // Parents of Panels drawn this frame
+    FramePacer * framePacer;        // NULL if frames are never held back
+    bool framePending;              // A frame was held back
+    bool synchronizedOutput;
+    int lines, columns;             // Size as of when it was last selected
+    bool resized;                   // Owed a KEY_RESIZE
+
+    TerminalState(SCREEN * screenIn, FILE * outputIn, FILE * inputIn) :
+        screen(screenIn), output(outputIn), input(inputIn), directOutput(NULL),
+        inputPad(NULL), placeholder(NULL), framePacer(NULL), framePending(false),
+        synchronizedOutput(false), lines(LINES), columns(COLS), resized(false) {}
+
+};
+
+// Closed terminals leave a NULL behind, so the others keep their numbers
+static std::vector<TerminalState *> terminals;
+static TerminalState * terminal = NULL;     // The selected one
+
+/*
+ * Every Panel, kept as parallel arrays of what each frame asks about them:
+ * the terminal it's on, where it is, what order it's drawn in, and whether
+ * it's waiting to be drawn or hidden. Working out which Panels need
+ * anything is then a walk over packed data, without touching the Panels
+ * themselves. Each Panel knows its own index. Removing one moves the last
+ * entry into its place, so entries aren't kept in the order the Panels
+ * were made; the sequence number each one was given says that instead.
+ */
+struct PanelRegistry {
+
+    std::vector<Panel *> panels;
+    std::vector<SCREEN *> screens;
+    std::vector<Box> bounds;                // Global dimensions
+    std::vector<int> zOrders;
+    std::vector<unsigned char> dirty;       // Invalidated
+    std::vector<unsigned char> shown;
+    std::vector<unsigned long> sequences;   // Order the Panels were made in
+    unsigned long nextSequence = 0;
+
+    size_t size() const { return panels.size(); }
+
+    size_t add(Panel * panel, SCREEN * screen, bool hidden) {
+        panels.push_back(panel);
+        screens.push_back(screen);
+        bounds.push_back(Box());
+        zOrders.push_back(0);
+        dirty.push_back(0);
+        shown.push_back(!hidden);
+        sequences.push_back(nextSequence++);
+        return panels.size() - 1;
+    }
+
+    // The last entry takes the removed one's place. Returns the Panel that
+    // moved, which needs its index updated, or NULL if none did.
+    Panel * remove(size_t index) {
+        size_t last = panels.size() - 1;
+        if(index != last) {
+            panels[index] = panels[last];
+            screens[index] = screens[last];
+            bounds[index] = bounds[last];
+            zOrders[index] = zOrders[last];
+            dirty[index] = dirty[last];
+            shown[index] = shown[last];
+            sequences[index] = sequences[last];
+        }
+        panels.pop_back();
+        screens.pop_back();
+        bounds.pop_back();
+        zOrders.pop_back();
+        dirty.pop_back();
+        shown.pop_back();
+        sequences.pop_back();
+        return (index != last) ? panels[index] : NULL;
+    }
+
+};
+
+static PanelRegistry panelRegistry;
+// Every Form, and the terminal it was made on
+static std::vector<std::pair<SCREEN *, Form *>> liveForms;
+
+// Hidden Panels still holding a window, and when they were hidden
+static std::vector<std::pair<Panel *, std::chrono::steady_clock::time_point>> hiddenPanels;
+static int hiddenWindowTimeout = 5000;
+
+static void forgetHiddenPanel(Panel * panel) {
+    hiddenPanels.erase(std::remove_if(hiddenPanels.begin(), hiddenPanels.end(),
+                                      [panel](const std::pair<Panel *, std::chrono::steady_clock::time_point> & hidden) {
+                                          return hidden.first == panel;
+                                      }),
+                       hiddenPanels.end());
+}
+
+// Point curses at another terminal, returning the one selected before
+static TerminalState * switchTerminal(TerminalState * state) {
+    TerminalState * previous = terminal;
+    if(state != NULL && state != terminal) {
+        if(terminal != NULL) {
+            terminal->lines = LINES;
+            terminal->columns = COLS;
+        }
+        set_term(state->screen);
+        terminal = state;
+#if !NCURSES_REENTRANT
+        // set_term() leaves these as they were for the last terminal
+        LINES = state->lines;
+        COLS = state->columns;
+#endif
+    }
+    return previous;
+}
+
+static TerminalState * findTerminal(SCREEN * screen) {
+    for(TerminalState * state : terminals) {
+        if(state != NULL && state->screen == screen) {
+            return state;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Call after anything that may have resized the selected terminal. Some
+ * ncurses builds resize the windows of every SCREEN along with the one
+ * being resized, so the other terminals have their screens and Panels put
+ * back the way they were, and are owed a KEY_RESIZE to redraw.
+ */
+static void checkScreenSize() {
+    if(terminal == NULL || (LINES == terminal->lines && COLS == terminal->columns)) {
+        return;
+    }
+    terminal->lines = LINES;
+    terminal->columns = COLS;
+
+    TerminalState * selected = terminal;
+    for(TerminalState * state : terminals) {
+        if(state == NULL || state == selected) { continue; }
+        switchTerminal(state);
+        if(getmaxy(curscr) == LINES && getmaxx(curscr) == COLS &&
+           getmaxy(stdscr) == LINES && getmaxx(stdscr) == COLS) {
+            continue;
+        }
+
+        wresize(curscr, LINES, COLS);
+        wresize(newscr, LINES, COLS);
+        wresize(stdscr, LINES, COLS);
+        clearok(curscr, TRUE);
+        for(size_t i = 0; i < panelRegistry.size(); i++) {
+            if(panelRegistry.screens[i] == state->screen) {
+                panelRegistry.panels[i]->resizePanel(panelRegistry.bounds[i]);
+            }
+        }
+        state->resized = true;
+    }
+    switchTerminal(selected);
+}
+
+// Color pairs are shared by every terminal, so they're made on all of them
+static void initSharedPair(short pair, short foreground, short background) {
+    if(terminals.empty()) {
+        init_pair(pair, foreground, background);
+        return;
+    }
+
+    TerminalState * selected = terminal;
+    for(TerminalState * state : terminals) {
+        if(state == NULL) { continue; }
+        switchTerminal(state);
+        init_pair(pair, foreground, background);
+    }
+    switchTerminal(selected);
+}
+
+// Show whatever has been drawn since the last frame on the selected
+// terminal, on either backend. Returns false if its FramePacer held it
+// back for now.
+static bool presentFrame() {
+    if(terminal == NULL) {
+        doupdate();
+        return true;
+    }
+
+    FramePacer * framePacer = terminal->framePacer;
+    if(framePacer != NULL && !framePacer->ready()) {
+        terminal->framePending = true;
+        return false;
+    }
+
+    // Panels drawn inside others only synced their changes up, and their
+    // parents' windows go out once for all of them
+    for(WINDOW * synced : terminal->synced) {
+        wnoutrefresh(synced);
+    }
+    terminal->synced.clear();
+
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    terminal->framePending = false;
+
+    long long written = -1;
+    if(terminal->directOutput != NULL) {
+        written = terminal->directOutput->present(terminal->synchronizedOutput);
+    } else if(!terminal->synchronizedOutput ||
+              !(is_wintouched(newscr) || is_cleared(newscr) || is_cleared(curscr))) {
+        doupdate();
+    } else {
+        // curses buffers the start marker along with the frame, and flushes
+        // both when doupdate() finishes. The end marker needs a flush of its
+        // own, which an idle doupdate() gives us.
+        putp(beginSynchronizedUpdate);
+        doupdate();
+        putp(endSynchronizedUpdate);
+        doupdate();
+    }
+    checkScreenSize(); // doupdate() catches up on SIGWINCH too
+
+    if(frameMetrics != NULL) {
+        frameMetrics->flushed(terminal, written);
+    }
+    if(framePacer != NULL) {
+        framePacer->presented(started);
+    }
+    return true;
+}
+
+// Send a frame to every open terminal, leaving the selected one selected
+static void presentAllFrames() {
+    if(terminals.empty()) {
+        presentFrame();
+        return;
+    }
+
+    TerminalState * selected = terminal;
+    for(TerminalState * state : terminals) {
+        if(state == NULL) { continue; }
+        switchTerminal(state);
+        presentFrame();
+    }
+    switchTerminal(selected);
+}
+
+// Terminal reports look like ESC [ ? digits ; ... and end in a letter.
+// Returns the position of the next one at or after start, or npos.
+static size_t findTerminalReport(const std::string & text, size_t start, size_t & length) {
+    for(size_t i = text.find("\033[?", start); i != std::string::npos;
+        i = text.find("\033[?", i + 1)) {
+        size_t end = i + 3;
+        while(end < text.size() && (isdigit((unsigned char)text[end]) ||
+              text[end] == ';' || text[end] == '$')) {
+            end++;
+        }
+        if(end < text.size() && isalpha((unsigned char)text[end])) {
+            length = end + 1 - i;
+            return i;
+        }
+    }
+    return std::string::npos;
+}
+
+/*
+ * Ask the terminal whether it supports mode 2026 (DECRQM), and follow up
+ * with a device attributes request (DA1), which every terminal answers. That
+ * way we only wait out the timeout on terminals that don't answer at all.
+ * Anything the user typed in the meantime is handed back to curses. This
+ * asks the selected terminal.
+ */
+static bool probeSynchronizedOutput() {
+    int inputFd = fileno(terminal->input);
+    if(!isatty(inputFd)) { return false; }
+
+    fputs("\033[?2026$p\033[c", terminal->output);
+    fflush(terminal->output);
+
+    std::string reply;
+    bool supported = false;
+    bool answered = false;
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(250);
+
+    while(!answered) {
+        int remaining = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+        if(remaining <= 0) { break; }
+
+        struct pollfd fd = { inputFd, POLLIN, 0 };
+        if(poll(&fd, 1, remaining) <= 0) { continue; }
+
+        char buffer[256];
+        ssize_t length = read(inputFd, buffer, sizeof(buffer));
+        if(length <= 0) { break; }
+        reply.append(buffer, length);
+
+        // Pull out the reports, leaving only what the user typed
+        size_t start = 0, reportLength;
+        while((start = findTerminalReport(reply, start, reportLength)) != std::string::npos) {
+            std::string report = reply.substr(start, reportLength);
+            if(report == "\033[?2026;1$y" || report == "\033[?2026;2$y") {
+                supported = true;
+            }
+            if(report.back() == 'c') {
+                answered = true;
+            }
+            reply.erase(start, reportLength);
+        }
+    }
+
+    for(auto key = reply.rbegin(); key != reply.rend(); key++) {
+        ungetch((unsigned char)*key);
+    }
+
+    return supported;
+}
+
+// Everything that follows frames hears about them from these
+static void beginFrame(int key) {
+    if(frameWatchdog != NULL) {
+        frameWatchdog->beginFrame(key);
+    }
+    if(frameMetrics != NULL) {
+        frameMetrics->beginFrame(key, terminal);
+    }
+#ifdef VEXES_COUNT_ALLOCATIONS
+    if(allocationLog != NULL) {
+        allocationLog->beginFrame(key);
+    }
+#endif
+}
+
+static void endFrame() {
+    if(frameWatchdog != NULL) {
+        frameWatchdog->endFrame();
+    }
+    if(frameMetrics != NULL) {
+        frameMetrics->endFrame();
+    }
+#ifdef VEXES_COUNT_ALLOCATIONS
+    if(allocationLog != NULL) {
+        allocationLog->endFrame();
+    }
+#endif
+}
+
+static void chargePanel(const std::string & title, Point origin) {
+    if(frameWatchdog != NULL) {
+        frameWatchdog->chargePanel(title, origin);
+    }
+    if(frameMetrics != NULL) {
+        frameMetrics->chargePanel(title);
+    }
+}
+
+static void chargePresent(std::chrono::steady_clock::time_point began) {
+    if(frameWatchdog != NULL) {
+        frameWatchdog->chargePresent(began);
+    }
+    if(frameMetrics != NULL) {
+        frameMetrics->moveCheckpoint();
+    }
+}
+
+#ifdef VEXES_COUNT_CALLS
+/*
+ * The counted curses calls the header swaps in. Calls are counted by call
+ * site, and by window. A window's counts are only put down to its Panel
+ * when it's deleted, since Panels make their window before they have hold
+ * of it, so its newwin() is counted too.
+ */
+enum CountedCall {
+    CALL_WMOVE, CALL_WADDCH, CALL_WADDSTR, CALL_WADDNSTR, CALL_WATTRON,
+    CALL_WATTROFF, CALL_WREFRESH, CALL_WNOUTREFRESH, CALL_NEWWIN, CALL_DELWIN,
+    COUNTED_CALLS
+};
+
+static const char * const countedCallNames[COUNTED_CALLS] = {
+    "wmove", "waddch", "waddstr", "waddnstr", "wattron",
+    "wattroff", "wrefresh", "wnoutrefresh", "newwin", "delwin"
+};
+
+struct CallSite {
+
+    CountedCall call;
+    const char * file;
+    int line;
+    const char * caller;
+
+    bool operator<(const CallSite & other) const {
+        if(line != other.line) { return line < other.line; }
+        if(call != other.call) { return call < other.call; }
+        int files = strcmp(file, other.file);
+        if(files != 0) { return files < 0; }
+        return strcmp(caller, other.caller) < 0;
+    }
+
+};
+
+struct CallCounts {
+
+    unsigned long counts[COUNTED_CALLS] = {};
+
+    unsigned long total() const {
+        unsigned long sum = 0;
+        for(unsigned long count : counts) { sum += count; }
+        return sum;
+    }
+
+};
+
+static std::map<CallSite, unsigned long> callsBySite;
+static std::map<WINDOW *, CallCounts> callsByWindow;
+static std::map<std::string, CallCounts> callsByOwner;
+
+static void countCall(CountedCall call, WINDOW * win, const char * file, int line,
+                      const char * caller) {
+    callsBySite[{call, file, line, caller}]++;
+    callsByWindow[win].counts[call]++;
+}
+
+// Put a window's calls down to whichever Panel has it, if any
+static void settleCalls(WINDOW * win) {
+    auto calls = callsByWindow.find(win);
+    if(calls == callsByWindow.end()) { return; }
+
+    std::string owner = (win != NULL && win == stdscr) ? "stdscr" : "(other windows)";
+    for(Panel * panel : panelRegistry.panels) {
+        if(panel->getWin() == win) {
+            owner = "Panel \"" + panel->getTitle() + "\"";
+            break;
+        }
+    }
+
+    CallCounts & total = callsByOwner[owner];
+    for(int call = 0; call < COUNTED_CALLS; call++) {
+        total.counts[call] += calls->second.counts[call];
+    }
+    callsByWindow.erase(calls);
+}
+
+static void settleAllCalls() {
+    while(!callsByWindow.empty()) {
+        settleCalls(callsByWindow.begin()->first);
+    }
+}
+
+// Busiest first, to VEXES_CALL_REPORT or stderr, starting afresh after
+static void reportCalls() {
+    settleAllCalls();
+
+    const char * path = getenv("VEXES_CALL_REPORT");
+    FILE * file = (path != NULL && *path != '\0') ? fopen(path, "w") : NULL;
+    FILE * out = (file != NULL) ? file : stderr;
+
+    std::vector<std::pair<CallSite, unsigned long>> sites(callsBySite.begin(), callsBySite.end());
+    std::sort(sites.begin(), sites.end(),
+              [](const std::pair<CallSite, unsigned long> & a,
+                 const std::pair<CallSite, unsigned long> & b) { return a.second > b.second; });
+    fprintf(out, "curses calls by call site:\n");
+    for(const auto & site : sites) {
+        fprintf(out, "%10lu  %-12s  %s:%d (%s)\n", site.second, countedCallNames[site.first.call],
+                site.first.file, site.first.line, site.first.caller);
+    }
+
+    std::vector<std::pair<std::string, CallCounts>> owners(callsByOwner.begin(), callsByOwner.end());
+    std::sort(owners.begin(), owners.end(),
+              [](const std::pair<std::string, CallCounts> & a,
+                 const std::pair<std::string, CallCounts> & b) { return a.second.total() > b.second.total(); });
+    fprintf(out, "\ncurses calls by window:\n");
+    for(const auto & owner : owners) {
+        fprintf(out, "%10lu  %s:", owner.second.total(), owner.first.c_str());
+        for(int call = 0; call < COUNTED_CALLS; call++) {
+            if(owner.second.counts[call] > 0) {
+                fprintf(out, " %s %lu", countedCallNames[call], owner.second.counts[call]);
+            }
+        }
+        fprintf(out, "\n");
+    }
+
+    if(file != NULL) { fclose(file); }
+    callsBySite.clear();
+    callsByOwner.clear();
+}
+
+// The parentheses keep the header's macros from counting these twice
+int countedWmove(WINDOW * win, int y, int x, const char * file, int line, const char * caller) {
+    countCall(CALL_WMOVE, win, file, line, caller);
+    return (wmove)(win, y, x);
+}
+
+int countedWaddch(WINDOW * win, chtype ch, const char * file, int line, const char * caller) {
+    countCall(CALL_WADDCH, win, file, line, caller);
+    return (waddch)(win, ch);
+}
+
+int countedWaddstr(WINDOW * win, const char * str, const char * file, int line, const char * caller) {
+    countCall(CALL_WADDSTR, win, file, line, caller);
+    return (waddstr)(win, str);
+}
+
+int countedWaddnstr(WINDOW * win, const char * str, int n, const char * file, int line,
+                    const char * caller) {
+    countCall(CALL_WADDNSTR, win, file, line, caller);
+    return (waddnstr)(win, str, n);
+}
+
+int countedWattron(WINDOW * win, int attrs, const char * file, int line, const char * caller) {
+    countCall(CALL_WATTRON, win, file, line, caller);
+    return (wattron)(win, attrs);
+}
+
+int countedWattroff(WINDOW * win, int attrs, const char * file, int line, const char * caller) {
+    countCall(CALL_WATTROFF, win, file, line, caller);
+    return (wattroff)(win, attrs);
+}
+
+int countedWrefresh(WINDOW * win, const char * file, int line, const char * caller) {
+    countCall(CALL_WREFRESH, win, file, line, caller);
+    return (wrefresh)(win);
+}
+
+int countedWnoutrefresh(WINDOW * win, const char * file, int line, const char * caller) {
+    countCall(CALL_WNOUTREFRESH, win, file, line, caller);
+    return (wnoutrefresh)(win);
+}
+
+WINDOW * countedNewwin(int lines, int columns, int y, int x, const char * file, int line,
+                       const char * caller) {
+    WINDOW * win = (newwin)(lines, columns, y, x);
+    countCall(CALL_NEWWIN, win, file, line, caller);
+    return win;
+}
+
+int countedDelwin(WINDOW * win, const char * file, int line, const char * caller) {
+    countCall(CALL_DELWIN, win, file, line, caller);
+    settleCalls(win);
+    return (delwin)(win);
+}
+#endif
+
+// The last mouse event getInput() saw, live or replayed
+static MEVENT lastMouseEvent;
+static bool hasMouseEvent = false;
+
+/*
+ * Everything besides a key that can end getInput()'s wait. When none of
+ * these are pending, the Engine sleeps until a key actually arrives.
+ */
+struct Timer {
+
+    int id;
+    std::chrono::steady_clock::time_point due;
+    int interval;                   // Milliseconds, for repeating timers
+    bool repeat;
+    // Shared, so running a timer never has to copy whatever it captured
+    std::shared_ptr<std::function<void()>> callback;
+    std::string name;               // For frame budget reports
+
+};
+
+static std::vector<Timer> timers;
+static int nextTimerId = 1;
+static int runningAnimations = 0;
+static int animationInterval = 33;
+static std::chrono::steady_clock::time_point nextAnimationFrame;
+struct WatchedFd {
+
+    int fd;
+    std::function<bool()> callback; // Whether to wake, or empty for always
+
+};
+
+static std::vector<WatchedFd> watchedFds;
+static std::vector<WatchedFd> addedWatchedFds;  // Watched from a callback
+static bool callingWatchedFds = false;
+
+// Take out what callbacks unwatched (left with an fd of -1), and put in
+// what they watched
+static void settleWatchedFds() {
+    watchedFds.erase(std::remove_if(watchedFds.begin(), watchedFds.end(),
+                                    [](const WatchedFd & watched) { return watched.fd < 0; }),
+                     watchedFds.end());
+    for(WatchedFd & added : addedWatchedFds) {
+        watchedFds.push_back(std::move(added));
+    }
+    addedWatchedFds.clear();
+}
+static const int resizePollMs = 250;   // For terminals without SIGWINCH
+static int invalidatedPanels = 0;
+static bool firstFrame = false;         // Apps draw once getInput() returns
+static bool redrawingOverWindow = false;
+
+// Milliseconds until something other than a key needs getInput() to
+// return, or a hidden Panel's window needs letting go of, or -1 if nothing
+// does. Only the app's own loop, reading stdscr,
+// draws Panels, so they only cut the wait short there. Anything else, like
+// Form::edit(), would spin on them until it finished.
+static int millisecondsUntilWake(bool drawsPanels) {
+    if(drawsPanels && (invalidatedPanels > 0 || firstFrame)) { return 0; }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    auto until = [&now](std::chrono::steady_clock::time_point then) {
+        if(then <= now) { return 0; }
+        // Round up, so we never wake a little too early and go back to sleep
+        return (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                then - now + std::chrono::microseconds(999)).count();
+    };
+
+    int wake = -1;
+    for(const Timer & timer : timers) {
+        int due = until(timer.due);
+        wake = (wake < 0) ? due : std::min(wake, due);
+    }
+    if(runningAnimations > 0) {
+        int due = until(nextAnimationFrame);
+        wake = (wake < 0) ? due : std::min(wake, due);
+    }
+    for(const auto & hidden : hiddenPanels) {
+        int due = until(hidden.second + std::chrono::milliseconds(hiddenWindowTimeout));
+        wake = (wake < 0) ? due : std::min(wake, due);
+    }
+    return wake;
+}
+
+// Run any timers that are due, and move the next animation frame along
+static void runDueTimers() {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(runningAnimations > 0 && nextAnimationFrame <= now) {
+        nextAnimationFrame = now + std::chrono::milliseconds(animationInterval);
+    }
+
+    // Callbacks can add and remove timers, so go by id rather than position.
+    // Ids only go up, and new timers are never due yet, so each pass takes
+    // the lowest due id past the last one we ran.
+    int last = 0;
+    while(true) {
+        auto timer = timers.end();
+        for(auto t = timers.begin(); t != timers.end(); t++) {
+            if(t->id > last && t->due <= now && (timer == timers.end() || t->id < timer->id)) {
+                timer = t;
+            }
+        }
+        if(timer == timers.end()) { break; }
+        last = timer->id;
+
+        std::shared_ptr<std::function<void()>> callback = timer->callback;
+        std::string name = (frameWatchdog != NULL) ? timer->name : std::string();
+        if(timer->repeat) {
+            timer->due = now + std::chrono::milliseconds(timer->interval);
+        } else {
+            timers.erase(timer);
+        }
+
+        std::chrono::steady_clock::time_point began = std::chrono::steady_clock::now();
+        (*callback)();
+        if(frameWatchdog != NULL) {
+            frameWatchdog->chargeTimer(name, began);
+        }
+        if(frameMetrics != NULL) {
+            frameMetrics->moveCheckpoint();
+        }
+    }
+}
+
+/*
+ * Wait up to delay milliseconds for a key (forever, if it's negative), but
+ * if a frame is being held back, wake up to send it once the FramePacer
+ * allows. A key that arrives first always wins, and the frame waits a
+ * little longer.
+ */
+static int waitForKey(WINDOW * win, int delay) {
+    // With the direct backend, keys come through the pad instead
+    bool direct = terminal != NULL && terminal->directOutput != NULL;
+    WINDOW * source = direct ? terminal->inputPad : win;
+    int original = wgetdelay(win);
+
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(delay);
+
+    int key = ERR;
+    while(true) {
+        bool pending = terminal != NULL && terminal->framePending;
+        int wait = delay;
+        if(pending) {
+            int remaining = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now()).count();
+            wait = terminal->framePacer->untilReady();
+            if(delay >= 0) { wait = std::max(std::min(wait, remaining), 0); }
+        }
+
+        wtimeout(source, wait);
+        key = wgetch(source);
+        checkScreenSize();
+        if(key != ERR || !pending) { break; }
+
+        presentFrame();
+        if(delay >= 0 && std::chrono::steady_clock::now() >= deadline) { break; }
+    }
+
+    wtimeout(win, original);
+    return key;
+}
+
+/*
+ * Only the terminal the app started in gets SIGWINCH, so the others are
+ * checked for a new size by hand. Returns true (and resizes curses to
+ * match) if the selected terminal changed size.
+ */
+static bool terminalResized() {
+    struct winsize size;
+    if(ioctl(fileno(terminal->output), TIOCGWINSZ, &size) != 0 ||
+       size.ws_row == 0 || size.ws_col == 0 ||
+       (size.ws_row == LINES && size.ws_col == COLS)) {
+        return false;
+    }
+
+    resize_term(size.ws_row, size.ws_col);
+    clearok(curscr, TRUE);
+    checkScreenSize();
+    return true;
+}
+
+/*
+ * The same, but for when more than one terminal is open, or there are file
+ * descriptors to watch. One poll() waits on all of them, waking up for
+ * whichever has a key or a held back frame first. The terminal the key came
+ * from is left selected, and a watched descriptor becoming readable ends
+ * the wait with ERR. Unless only is NULL, keys are only taken from that
+ * terminal, though the others still get their held back frames sent.
+ *
+ * SIGWINCH stays blocked except while in ppoll(), so a resize can't slip in
+ * between checking for keys and going to sleep.
+ */
+static int waitForAnyKey(int delay, TerminalState * only) {
+    TerminalState * selected = terminal;
+
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(delay);
+
+    sigset_t resize, unblocked;
+    sigemptyset(&resize);
+    sigaddset(&resize, SIGWINCH);
+    pthread_sigmask(SIG_BLOCK, &resize, &unblocked);
+
+    // Kept between calls, so once it has grown, waiting costs nothing
+    static std::vector<struct pollfd> inputs;
+
+    int key = ERR;
+    while(key == ERR) {
+        int remaining = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+        int wait = (delay >= 0) ? std::max(remaining, 0) : -1;
+
+        inputs.clear();
+        for(TerminalState * state : terminals) {
+            if(state == NULL) { continue; }
+            switchTerminal(state);
+
+            if(state->framePending && !presentFrame()) {
+                int untilReady = state->framePacer->untilReady();
+                wait = (wait < 0) ? untilReady : std::min(wait, untilReady);
+            }
+            if(only != NULL && state != only) { continue; }
+
+            if(state->resized || (state != terminals[0] && terminalResized())) {
+                state->resized = false;
+                key = KEY_RESIZE;
+                break;
+            }
+
+            // curses may already have keys it read ahead, so ask it first.
+            // A pad is never refreshed by wgetch(), unlike stdscr.
+            wtimeout(state->inputPad, 0);
+            key = wgetch(state->inputPad);
+            checkScreenSize();
+            if(key != ERR) { break; }
+
+            struct pollfd input = { fileno(state->input), POLLIN, 0 };
+            inputs.push_back(input);
+        }
+        if(key != ERR || (delay >= 0 && remaining <= 0)) { break; }
+
+        // Nothing tells us when the other terminals are resized, so we have
+        // to keep looking
+        if(inputs.size() > 1) {
+            wait = (wait < 0) ? resizePollMs : std::min(wait, resizePollMs);
+        }
+
+        size_t terminalCount = inputs.size();
+        for(const WatchedFd & watched : watchedFds) {
+            struct pollfd input = { watched.fd, POLLIN, 0 };
+            inputs.push_back(input);
+        }
+
+        struct timespec timeout = { wait / 1000, (wait % 1000) * 1000000L };
+        if(ppoll(inputs.data(), inputs.size(), (wait >= 0) ? &timeout : NULL, &unblocked) <= 0) {
+            continue;
+        }
+
+        // Callbacks may unwatch, so look each one up again. They're called
+        // where they are, and watching or unwatching from inside one is put
+        // off until they've all run, so none of them moves while it runs.
+        bool wake = false;
+        callingWatchedFds = true;
+        for(size_t i = terminalCount; i < inputs.size(); i++) {
+            if(inputs[i].revents == 0) { continue; }
+            int fd = inputs[i].fd;
+            auto watched = std::find_if(watchedFds.begin(), watchedFds.end(),
+                                        [fd](const WatchedFd & w) { return w.fd == fd; });
+            if(watched == watchedFds.end()) { continue; }
+            const std::function<bool()> & callback = watched->callback;
+            wake = (!callback || callback()) || wake;
+        }
+        callingWatchedFds = false;
+        settleWatchedFds();
+        if(wake) { break; }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &unblocked, NULL);
+    if(key == ERR) {
+        switchTerminal(selected);
+    }
+    return key;
+}
+
+// Hidden Panels that have been hidden long enough let go of their windows.
+// Their releaseCaches() takes them off the list, or might hide and show
+// others, so each is taken off before it's called.
+static void releaseHiddenWindows() {
+    if(hiddenPanels.empty()) { return; }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    for(size_t i = hiddenPanels.size(); i-- > 0; ) {
+        if(i >= hiddenPanels.size() ||
+           now - hiddenPanels[i].second < std::chrono::milliseconds(hiddenWindowTimeout)) {
+            continue;
+        }
+        Panel * panel = hiddenPanels[i].first;
+        hiddenPanels.erase(hiddenPanels.begin() + i);
+        panel->releaseCaches();
+    }
+}
+
+// The terminal a Panel's or Form's window was made on, or the selected one
+// for windows the Engine doesn't know
+static TerminalState * terminalOfWindow(WINDOW * win) {
+    for(size_t i = 0; i < panelRegistry.size(); i++) {
+        if(panelRegistry.panels[i]->getWin() == win) {
+            return findTerminal(panelRegistry.screens[i]);
+        }
+    }
+    for(auto & live : liveForms) {
+        if(live.second->getWin() == win) {
+            return findTerminal(live.first);
+        }
+    }
+    return terminal;
+}
+
+static int openTerminalCount() {
+    return (int)std::count_if(terminals.begin(), terminals.end(),
+                              [](TerminalState * state) { return state != NULL; });
+}
+
+// Whether any of the terminals keys would be taken from (all of them, if
+// only is NULL) already has one waiting to be read
+static bool keysWaiting(TerminalState * only) {
+    static std::vector<struct pollfd> inputs;
+    inputs.clear();
+    for(TerminalState * state : terminals) {
+        if(state == NULL || (only != NULL && state != only)) { continue; }
+        struct pollfd input = { fileno(state->input), POLLIN, 0 };
+        inputs.push_back(input);
+    }
+    if(inputs.empty()) {
+        struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+        inputs.push_back(input);
+    }
+    return poll(inputs.data(), inputs.size(), 0) > 0;
+}
+
+int getInput(WINDOW * win) {
+    if(win == NULL) {
+        win = stdscr;
+    }
+
+    // wgetch() would have refreshed the window, but we do it ourselves so
+    // the frame goes out through whichever backend is in use
+    bool touched = is_wintouched(win);
+    if(touched) {
+        wnoutrefresh(win);
+    }
+    std::chrono::steady_clock::time_point presenting = std::chrono::steady_clock::now();
+    presentAllFrames();
+    chargePresent(presenting);
+    endFrame();
+    releaseHiddenWindows();
+
+    // Refreshing stdscr can cover Panels drawn since, which the next tick
+    // used to paint back. Without ticks, we give the app one more pass to do
+    // it, but only one, so drawing on stdscr every frame doesn't keep us
+    // awake. Other windows never ticked, so they don't get one.
+    bool redraw = touched && win == stdscr && !redrawingOverWindow;
+    redrawingOverWindow = redraw;
+
+    int key;
+    if(inputLog != NULL && inputLog->isReplaying() &&
+       inputLog->replay(key, lastMouseEvent)) {
+        hasMouseEvent = (key == KEY_MOUSE && lastMouseEvent.bstate != 0);
+        if(win == stdscr) {
+            firstFrame = false;
+        }
+        beginFrame(key);
+        runDueTimers();
+        return key;
+    }
+
+    // Wait as long as win would, but no longer than the next timer,
+    // animation frame, invalidated Panel or hidden Panel's window needs
+    int delay = wgetdelay(win);
+    int wake = millisecondsUntilWake(win == stdscr);
+    if(wake >= 0) {
+        delay = (delay < 0) ? wake : std::min(delay, wake);
+    }
+    if(redraw) {
+        delay = 0;
+    }
+    if(win == stdscr) {
+        firstFrame = false;
+    }
+
+    // Only the app's own loop takes keys from every terminal
+    bool anyKey = openTerminalCount() > 1 || !watchedFds.empty();
+    TerminalState * only = (win == stdscr) ? NULL : terminalOfWindow(win);
+    if(frameMetrics != NULL) {
+        frameMetrics->beginWait(keysWaiting(anyKey ? only : terminal));
+    }
+    if(anyKey) {
+        key = waitForAnyKey(delay, only);
+    } else {
+        key = waitForKey(win, delay);
+    }
+    hasMouseEvent = (key == KEY_MOUSE) && (getmouse(&lastMouseEvent) == OK);
+    beginFrame(key);
+    runDueTimers();
+    releaseHiddenWindows();
+
+    // Resizing cleared stdscr. It goes out now, under whatever the app draws
+    // for the new size, instead of over it when getInput() next comes round,
+    // which would wipe out Panels the app has no reason to draw again.
+    if(key == KEY_RESIZE && is_wintouched(stdscr)) {
+        wnoutrefresh(stdscr);
+    }
+
+    // The capture and input log only follow the first terminal
+    bool first = terminals.empty() || terminal == terminals[0];
+    if(key == KEY_RESIZE && outputCapture != NULL && first) {
+        outputCapture->resized(COLS, LINES);
+    }
+
+    if(inputLog != NULL && inputLog->isRecording() && first) {
+        inputLog->record(key, hasMouseEvent ? &lastMouseEvent : NULL);
+    }
+
+    return key;
+}
+
+bool getMouseInput(MEVENT & event) {
+    if(!hasMouseEvent) { return false; }
+
+    event = lastMouseEvent;
+    hasMouseEvent = false;
+    return true;
+}
+
+////////////////////////////////// METRICS ///////////////////////////////////
+
+const int Histogram::subBucketBits;
+const int Histogram::subBuckets;
+const int Histogram::bucketCount;
+
+Histogram::Histogram() {
+    reset();
+}
+
+// Small values get a bucket each. Past those, a value's bucket comes from
+// where its highest bit is, and the subBucketBits just below it.
+int Histogram::bucketFor(unsigned long long value) {
+    if(value < (unsigned long long)subBuckets) { return (int)value; }
+
+    int shift = 63 - __builtin_clzll(value) - subBucketBits;
+    return (shift + 1) * subBuckets + (int)((value >> shift) & (subBuckets - 1));
+}
+
+unsigned long long Histogram::bucketStart(int bucket) {
+    if(bucket < subBuckets) { return bucket; }
+
+    int shift = bucket / subBuckets - 1;
+    return (unsigned long long)(subBuckets + bucket % subBuckets) << shift;
+}
+
+void Histogram::record(unsigned long long value) {
+    counts[bucketFor(value)]++;
+    minimum = (count == 0) ? value : std::min(minimum, value);
+    maximum = std::max(maximum, value);
+    count++;
+    sum += value;
+}
+
+void Histogram::reset() {
+    std::fill(counts, counts + bucketCount, 0ULL);
+    count = sum = minimum = maximum = 0;
+}
+
+unsigned long long Histogram::getCount() const {
+    return count;
+}
+
+unsigned long long Histogram::getSum() const {
+    return sum;
+}
+
+unsigned long long Histogram::getMin() const {
+    return minimum;
+}
+
+unsigned long long Histogram::getMax() const {
+    return maximum;
+}
+
+double Histogram::getMean() const {
+    return (count > 0) ? (double)sum / count : 0.0;
+}
+
+unsigned long long Histogram::getPercentile(double percent) const {
+    if(count == 0) { return 0; }
+
+    percent = std::min(std::max(percent, 0.0), 100.0);
+    unsigned long long rank = std::max((unsigned long long)ceil(percent / 100.0 * count), 1ULL);
+    unsigned long long seen = 0;
+    for(int bucket = 0; bucket < bucketCount; bucket++) {
+        seen += counts[bucket];
+        if(seen < rank) { continue; }
+
+        // The top of the bucket, but never past what was actually seen
+        unsigned long long top = (bucket + 1 < bucketCount) ? bucketStart(bucket + 1) - 1 : ULLONG_MAX;
+        return std::max(std::min(top, maximum), minimum);
+    }
+    return maximum;
+}
+
+unsigned long long Histogram::countAtOrBelow(unsigned long long limit) const {
+    if(limit == ULLONG_MAX) { return count; }
+
+    // Only buckets entirely at or below limit, so one short of a power of
+    // two loses nothing, since every power of two starts a bucket
+    unsigned long long below = 0;
+    for(int bucket = bucketFor(limit + 1) - 1; bucket >= 0; bucket--) {
+        below += counts[bucket];
+    }
+    return below;
+}
+
+// Quote a label value the way the Prometheus text format wants it
+static void appendPrometheusLabel(std::string & out, const char * name, const std::string & value) {
+    out += name;
+    out += "=\"";
+    for(char c : value) {
+        if(c == '\\' || c == '"') {
+            out += '\\';
+            out += c;
+        } else if(c == '\n') {
+            out += "\\n";
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+/*
+ * One Histogram's series, with a bucket for each power of two from 2^first
+ * to 2^last. Prometheus buckets count values at or below their limit, and a
+ * power of two starts one of the Histogram's buckets rather than ending one,
+ * so each limit is one short of the power of two. Values are whole numbers,
+ * so that's the same as counting everything below the power of two, and
+ * countAtOrBelow() is exact for it. scale turns the recorded unit into the
+ * exported one, like microseconds into seconds.
+ */
+static void appendPrometheusHistogram(std::string & out, const char * name, const std::string & labels,
+                                      const Histogram & histogram, int first, int last, double scale) {
+    char number[64];
+    std::string prefix = labels.empty() ? "{" : "{" + labels + ",";
+    for(int power = first; power <= last + 1; power++) {
+        out += name;
+        out += "_bucket";
+        out += prefix;
+        if(power <= last) {
+            unsigned long long limit = (1ULL << power) - 1;
+            snprintf(number, sizeof(number), "le=\"%.9g\"} %llu\n", limit * scale,
+                     histogram.countAtOrBelow(limit));
+        } else {
+            snprintf(number, sizeof(number), "le=\"+Inf\"} %llu\n", histogram.getCount());
+        }
+        out += number;
+    }
+
+    std::string suffix = labels.empty() ? " " : "{" + labels + "} ";
+    snprintf(number, sizeof(number), "%.9g\n", histogram.getSum() * scale);
+    out += name;
+    out += "_sum";
+    out += suffix;
+    out += number;
+    snprintf(number, sizeof(number), "%llu\n", histogram.getCount());
+    out += name;
+    out += "_count";
+    out += suffix;
+    out += number;
+}
+
+static void appendPrometheusHeader(std::string & out, const char * name, const char * help) {
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += " histogram\n";
+}
+
+/////////////////////////////// BASE CLASSES /////////////////////////////////
+
+/* ENGINE */
+
+Engine::Engine() : Engine(EngineSettings()) {}
+
+Engine::Engine(EngineSettings settingsIn) : settings(settingsIn), mouseEnabled(false) {
+    readEnvironmentSettings();
+    setupCursesEnvironment();
+
+    // Recording and replaying can be turned on from outside the app
+    const char * record = getenv("VEXES_RECORD");
+    const char * replay = getenv("VEXES_REPLAY");
+    if(replay != NULL) {
+        replayInput(replay, getenv("VEXES_REPLAY_FAST") == NULL);
+    } else if(record != NULL) {
+        recordInput(record);
+    }
+}
+
+Engine::~Engine() {
+    formPool.clear();
+    panelPool.clear();
+    stopInputLog();
+    teardownCursesEnvironment();
+}
+
+void Engine::readEnvironmentSettings() {
+    const char * capture = getenv("VEXES_CAPTURE");
+    if(settings.capturePath.empty() && capture != NULL) {
+        settings.capturePath = capture;
+    }
+
+    const char * sync = getenv("VEXES_SYNC");
+    if(settings.synchronizedOutput == EngineSettings::SYNC_AUTO && sync != NULL) {
+        if(strcmp(sync, "on") == 0) {
+            settings.synchronizedOutput = EngineSettings::SYNC_ON;
+        } else if(strcmp(sync, "off") == 0) {
+            settings.synchronizedOutput = EngineSettings::SYNC_OFF;
+        }
+    }
+
+    const char * adaptive = getenv("VEXES_ADAPTIVE");
+    if(adaptive != NULL && strcmp(adaptive, "off") == 0) {
+        settings.adaptiveFrameRate = false;
+    }
+
+    const char * tick = getenv("VEXES_TICK");
+    if(settings.tickInterval == 0 && tick != NULL) {
+        settings.tickInterval = std::max(atoi(tick), 0);
+    }
+
+    const char * budget = getenv("VEXES_FRAME_BUDGET");
+    if(settings.frameBudget == 0 && budget != NULL) {
+        settings.frameBudget = std::max(atoi(budget), 0);
+    }
+
+    const char * report = getenv("VEXES_FRAME_REPORT");
+    if(report != NULL && *report != '\0') {
+        settings.frameReportPath = report;
+    }
+
+    const char * metrics = getenv("VEXES_METRICS");
+    if(metrics != NULL && strcmp(metrics, "on") == 0) {
+        settings.metrics = true;
+    }
+
+    const char * scrape = getenv("VEXES_METRICS_SOCKET");
+    if(settings.metricsSocket.empty() && scrape != NULL) {
+        settings.metricsSocket = scrape;
+    }
+
+    const char * low = getenv("VEXES_LOW_BANDWIDTH");
+    if(low != NULL && strcmp(low, "on") == 0) {
+        settings.lowBandwidth = true;
+    }
+
+    const char * backend = getenv("VEXES_BACKEND");
+    if(settings.backend == EngineSettings::CURSES_BACKEND && backend != NULL &&
+       strcmp(backend, "direct") == 0) {
+        settings.backend = EngineSettings::DIRECT_BACKEND;
+    }
+}
+
+bool Engine::recordInput(std::string path) {
+    stopInputLog();
+    inputLog = InputLog::open(path, true, false);
+    return inputLog != NULL;
+}
+
+bool Engine::replayInput(std::string path, bool realTime) {
+    stopInputLog();
+    inputLog = InputLog::open(path, false, realTime);
+    return inputLog != NULL;
+}
+
+void Engine::stopInputLog() {
+    delete inputLog;
+    inputLog = NULL;
+}
+
+void Engine::setupCursesEnvironment() {
+    // Capture has to be in place before curses writes its first byte
+    if(!settings.capturePath.empty()) {
+        outputCapture = OutputCapture::open(settings.capturePath);
+    }
+    if(settings.frameBudget > 0) {
+        frameWatchdog = FrameWatchdog::open(settings.frameReportPath, settings.frameBudget,
+                                            settings.frameReportInterval);
+    }
+    if(settings.metrics || !settings.metricsSocket.empty()) {
+        frameMetrics = new FrameMetrics();
+    }
+    if(!settings.metricsSocket.empty()) {
+        metricsSocket = MetricsSocket::open(settings.metricsSocket);
+        if(metricsSocket != NULL) {
+            watchFd(metricsSocket->getFd(), []() {
+                metricsSocket->serve();
+                return false;
+            });
+        }
+    }
+#ifdef VEXES_COUNT_ALLOCATIONS
+    const char * allocations = getenv("VEXES_ALLOCATION_LOG");
+    if(allocations != NULL && *allocations != '\0') {
+        allocationLog = AllocationLog::open(allocations);
+    }
+#endif
+
+    // Begin curses mode, just like initscr() would, but keep hold of the
+    // SCREEN so we can come back to it from any others
+    const char * type = getenv("TERM");
+    if(type == NULL || *type == '\0') { type = "unknown"; }
+    SCREEN * screen = newterm(type, stdout, stdin);
+    if(screen == NULL) {
+        fprintf(stderr, "Error opening terminal: %s.\n", type);
+        exit(EXIT_FAILURE);
+    }
+    def_prog_mode();
+
+    terminals.push_back(new TerminalState(screen, stdout, stdin));
+    terminal = terminals.back();
+    setupTerminal();
+
+    animationInterval = 1000 / std::max(settings.animationFrameRate, 1);
+    hiddenWindowTimeout = std::max(settings.hiddenWindowTimeout, 0);
+    firstFrame = true;
+}
+
+void Engine::setupTerminal() {
+    initializeScreenVariables();
+    initializeColorPairs();
+
+    // Every terminal gets a pad to read keys from, since wgetch() never
+    // refreshes a pad, and so never sends a frame of its own
+    terminal->inputPad = newpad(1, 1);
+    keypad(terminal->inputPad, TRUE);
+    terminal->placeholder = newpad(1, 1);
+
+    if(settings.backend == EngineSettings::DIRECT_BACKEND) {
+        setupDirectOutput();
+    }
+    setupSynchronizedOutput();
+
+    setupLowBandwidth();
+    if(settings.adaptiveFrameRate || settings.lowBandwidth) {
+        int minimum = settings.lowBandwidth ? 1000 / std::max(settings.lowBandwidthFrameRate, 1) : 0;
+        terminal->framePacer = new FramePacer(fileno(terminal->output), minimum,
+                                              settings.adaptiveFrameRate);
+    }
+}
+
+void Engine::setupLowBandwidth() {
+    lowBandwidth = settings.lowBandwidth;
+    lowBandwidthBytesPerSecond = settings.lowBandwidthBytesPerSecond;
+    if(!lowBandwidth) { return; }
+
+    // Let curses move content with line insert and delete, rather than
+    // redrawing every line that shifted
+    idlok(stdscr, TRUE);
+
+    // Panels and Themes only use the basic colours from here on, so
+    // existing pairs are brought down to match
+    for(short pair = 1; pair < COLOR_PAIRS && pair < 256; pair++) {
+        short foreground, background;
+        if(pair_content(pair, &foreground, &background) == OK &&
+           (foreground >= 8 || background >= 8)) {
+            init_pair(pair, basicColor(foreground), basicColor(background));
+        }
+    }
+}
+
+bool Engine::isLowBandwidth() {
+    return lowBandwidth;
+}
+
+bool Engine::animationsEnabled() {
+    return !lowBandwidth;
+}
+
+int Engine::getFrameByteBudget() {
+    if(!lowBandwidth) { return 0; }
+
+    // A frame may use whatever the link carries before the next one is due
+    int interval = (terminal != NULL && terminal->framePacer != NULL) ?
+                   terminal->framePacer->getInterval() : 0;
+    return std::max(lowBandwidthBytesPerSecond * std::max(interval, 1) / 1000, 1);
+}
+
+int Engine::addTimer(int milliseconds, std::function<void()> callback, bool repeat,
+                     std::string name) {
+    Timer timer;
+    timer.id = nextTimerId++;
+    timer.interval = std::max(milliseconds, 1);
+    timer.due = std::chrono::steady_clock::now() + std::chrono::milliseconds(timer.interval);
+    timer.repeat = repeat;
+    timer.callback = std::make_shared<std::function<void()>>(callback);
+    timer.name = name.empty() ? "timer " + std::to_string(timer.id) : name;
+    timers.push_back(timer);
+    return timer.id;
+}
+
+void Engine::removeTimer(int id) {
+    timers.erase(std::remove_if(timers.begin(), timers.end(),
+                                [id](const Timer & timer) { return timer.id == id; }),
+                 timers.end());
+}
+
+void Engine::chargeFrameTime(const std::string & name) {
+    if(frameWatchdog != NULL) {
+        frameWatchdog->chargeHandler(name);
+    }
+    if(frameMetrics != NULL) {
+        frameMetrics->moveCheckpoint();
+    }
+}
+
+// What the metrics getters hand out while metrics are off
+static const Histogram noMetrics;
+
+const Histogram & Engine::getFrameTimes() {
+    return (frameMetrics != NULL) ? frameMetrics->frameTimes : noMetrics;
+}
+
+const Histogram & Engine::getInputLatencies() {
+    return (frameMetrics != NULL) ? frameMetrics->inputLatencies : noMetrics;
+}
+
+const Histogram & Engine::getFlushBytes() {
+    return (frameMetrics != NULL) ? frameMetrics->flushBytes : noMetrics;
+}
+
+const Histogram * Engine::getPanelDrawTimes(const std::string & title) {
+    if(frameMetrics == NULL) { return NULL; }
+
+    auto panel = frameMetrics->panelDrawTimes.find(title.empty() ? "(untitled)" : title);
+    return (panel != frameMetrics->panelDrawTimes.end()) ? &panel->second : NULL;
+}
+
+void Engine::resetMetrics() {
+    if(frameMetrics != NULL) {
+        frameMetrics->reset();
+    }
+}
+
+std::string Engine::formatMetrics() {
+    // Frame times from 64us to about 4s, and flushes from 64B to 1MB
+    std::string out;
+    appendPrometheusHeader(out, "vexes_frame_seconds",
+                           "Time from getInput() waking up until the frame was sent.");
+    appendPrometheusHistogram(out, "vexes_frame_seconds", "", getFrameTimes(), 6, 22, 1e-6);
+    appendPrometheusHeader(out, "vexes_input_latency_seconds",
+                           "Time from a key arriving until the frame drawn for it was sent.");
+    appendPrometheusHistogram(out, "vexes_input_latency_seconds", "", getInputLatencies(), 6, 22, 1e-6);
+    appendPrometheusHeader(out, "vexes_flush_bytes", "Bytes sent to the terminal by each flush.");
+    appendPrometheusHistogram(out, "vexes_flush_bytes", "", getFlushBytes(), 6, 20, 1);
+
+    appendPrometheusHeader(out, "vexes_panel_draw_seconds", "Time spent drawing each Panel, by title.");
+    if(frameMetrics != NULL) {
+        for(const auto & panel : frameMetrics->panelDrawTimes) {
+            std::string label;
+            appendPrometheusLabel(label, "panel", panel.first);
+            appendPrometheusHistogram(out, "vexes_panel_draw_seconds", label, panel.second, 6, 22, 1e-6);
+        }
+    }
+    return out;
+}
+
+bool Engine::dumpMetrics(const std::string & path) {
+    std::string text = formatMetrics();
+    std::string temporary = path + ".tmp";
+    FILE * file = fopen(temporary.c_str(), "w");
+    if(file == NULL) { return false; }
+
+    bool written = fwrite(text.data(), 1, text.size(), file) == text.size();
+    written = (fclose(file) == 0) && written;
+    if(!written || rename(temporary.c_str(), path.c_str()) != 0) {
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+size_t Engine::getMemoryUsage() {
+    size_t usage = 0;
+    for(Panel * panel : panelRegistry.panels) {
+        usage += panel->getMemoryUsage();
+    }
+    for(auto & live : liveForms) {
+        usage += live.second->getMemoryUsage();
+    }
+
+    // Each terminal has its own screens, and the direct backend's buffers
+    TerminalState * selected = terminal;
+    for(TerminalState * state : terminals) {
+        if(state == NULL) { continue; }
+        switchTerminal(state);
+        usage += windowMemoryUsage(stdscr) + windowMemoryUsage(curscr) +
+                 windowMemoryUsage(newscr) + windowMemoryUsage(state->inputPad) +
+                 windowMemoryUsage(state->placeholder);
+        if(state->directOutput != NULL) {
+            usage += state->directOutput->getMemoryUsage();
+        }
+    }
+    switchTerminal(selected);
+    return usage;
+}
+
+int Engine::drawInvalidatedPanels() {
+    // Kept between frames, so once they've grown, picking costs nothing
+    static std::vector<size_t> picked;
+    static std::vector<Panel *> drawing;
+
+    picked.clear();
+    for(size_t i = 0; i < panelRegistry.size(); i++) {
+        if(panelRegistry.dirty[i] && panelRegistry.shown[i]) {
+            picked.push_back(i);
+        }
+    }
+    std::sort(picked.begin(), picked.end(), [](size_t a, size_t b) {
+        int za = panelRegistry.zOrders[a], zb = panelRegistry.zOrders[b];
+        return (za != zb) ? za < zb : panelRegistry.sequences[a] < panelRegistry.sequences[b];
+    });
+
+    drawing.clear();
+    for(size_t i : picked) {
+        drawing.push_back(panelRegistry.panels[i]);
+    }
+    for(Panel * panel : drawing) {
+        panel->drawPanel();
+    }
+    return (int)drawing.size();
+}
+
+void Engine::beginAnimation() {
+    if(runningAnimations++ == 0) {
+        nextAnimationFrame = std::chrono::steady_clock::now() +
+                             std::chrono::milliseconds(animationInterval);
+    }
+}
+
+void Engine::endAnimation() {
+    if(runningAnimations > 0) {
+        runningAnimations--;
+    }
+}
+
+void Engine::watchFd(int fd, std::function<bool()> callback) {
+    if(fd < 0) { return; }
+
+    unwatchFd(fd);
+    if(callingWatchedFds) {
+        addedWatchedFds.push_back({fd, callback});
+    } else {
+        watchedFds.push_back({fd, callback});
+    }
+}
+
+void Engine::unwatchFd(int fd) {
+    if(fd < 0) { return; }
+
+    addedWatchedFds.erase(std::remove_if(addedWatchedFds.begin(), addedWatchedFds.end(),
+                                         [fd](const WatchedFd & watched) { return watched.fd == fd; }),
+                          addedWatchedFds.end());
+    if(callingWatchedFds) {
+        for(WatchedFd & watched : watchedFds) {
+            if(watched.fd == fd) { watched.fd = -1; }
+        }
+        return;
+    }
+    watchedFds.erase(std::remove_if(watchedFds.begin(), watchedFds.end(),
+                                    [fd](const WatchedFd & watched) { return watched.fd == fd; }),
+                     watchedFds.end());
+}
+
+void Engine::setupDirectOutput() {
+    // Terminals that don't speak ANSI stay on curses
+    if(DirectOutput::supported()) {
+        terminal->directOutput = new DirectOutput(terminal->output);
+    }
+}
+
+void Engine::setupSynchronizedOutput() {
+    switch(settings.synchronizedOutput) {
+        case EngineSettings::SYNC_ON:
+            terminal->synchronizedOutput = true;
+            break;
+        case EngineSettings::SYNC_OFF:
+            terminal->synchronizedOutput = false;
+            break;
+        case EngineSettings::SYNC_AUTO: {
+            // Newer terminfo entries say so outright, otherwise we ask
+            const char * sync = tigetstr("Sync");
+            terminal->synchronizedOutput = (sync != NULL && sync != (char *)-1) ||
+                                 probeSynchronizedOutput();
+            break;
+        }
+    }
+}
+
+bool Engine::hasSynchronizedOutput() {
+    return terminal->synchronizedOutput;
+}
+
+int Engine::getFrameInterval() {
+    return (terminal->framePacer != NULL) ? terminal->framePacer->getInterval() : 0;
+}
+
+void Engine::initializeScreenVariables() {
+    cbreak();		        // Disable line buffering
+    keypad(stdscr, TRUE);	// Enable extra keys
+    noecho();		        // Disable echoing keys to console
+    start_color();		    // Enable color mode
+    curs_set(0);		    // Set cursor to be invisible
+
+    // Sleep until something happens, unless the app wants regular ticks
+    timeout((settings.tickInterval > 0) ? settings.tickInterval : -1);
+}
+
+void Engine::initializeColorPairs() {
+    int backgroundColor = -1; // Transparency
+    use_default_colors();
+
+    init_pair(0, COLOR_BLACK, backgroundColor);
+    init_pair(1, COLOR_RED, backgroundColor);
+    init_pair(2, COLOR_GREEN, backgroundColor);
+    init_pair(3, COLOR_YELLOW, backgroundColor);
+    init_pair(4, COLOR_BLUE, backgroundColor);
+    init_pair(5, COLOR_MAGENTA, backgroundColor);
+    init_pair(6, COLOR_CYAN, backgroundColor);
+    init_pair(7, COLOR_WHITE, backgroundColor);
+}
+
+void Engine::teardownCursesEnvironment() {
+#ifdef VEXES_COUNT_CALLS
+    // Anything drawn on stdscr has to be told apart while it's still there
+    settleAllCalls();
+#endif
+
+    for(size_t index = 1; index < terminals.size(); index++) {
+        closeTerminal(index);
+    }
+
+    if(!terminals.empty()) {
+        switchTerminal(terminals[0]);
+        teardownTerminal(); // Destroys stdscr
+        delete terminals[0];
+        terminals.clear();
+        terminal = NULL;
+    }
+    lowBandwidth = false;
+
+    // Only now has curses written everything it's going to
+    delete outputCapture;
+    outputCapture = NULL;
+    delete frameWatchdog;
+    frameWatchdog = NULL;
+    if(metricsSocket != NULL) {
+        unwatchFd(metricsSocket->getFd());
+        delete metricsSocket;
+        metricsSocket = NULL;
+    }
+    delete frameMetrics;
+    frameMetrics = NULL;
+#ifdef VEXES_COUNT_ALLOCATIONS
+    delete allocationLog;
+    allocationLog = NULL;
+#endif
+#ifdef VEXES_COUNT_CALLS
+    reportCalls();
+#endif
+}
+
+void Engine::teardownTerminal() {
+    if(mouseEnabled) {
+        // Stop the terminal from reporting drags after we're gone
+        fputs("\033[?1002l", terminal->output);
+        fflush(terminal->output);
+    }
+    delete terminal->framePacer;
+    terminal->framePacer = NULL;
+    terminal->framePending = false;
+    delete terminal->directOutput;
+    terminal->directOutput = NULL;
+    delwin(terminal->inputPad);
+    terminal->inputPad = NULL;
+    delwin(terminal->placeholder);
+    terminal->placeholder = NULL;
+    endwin();
+}
+
+int Engine::openTerminal(std::string path, std::string type) {
+    int fd = open(path.c_str(), O_RDWR | O_NOCTTY);
+    if(fd < 0) { return -1; }
+
+    int inputFd = dup(fd);
+    FILE * output = fdopen(fd, "w");
+    FILE * input = (inputFd >= 0) ? fdopen(inputFd, "r") : NULL;
+    if(output == NULL || input == NULL) {
+        if(output != NULL) { fclose(output); } else { close(fd); }
+        if(input != NULL) { fclose(input); } else if(inputFd >= 0) { close(inputFd); }
+        return -1;
+    }
+
+    // Color pairs are shared, so the new terminal starts with a copy of the
+    // first one's
+    TerminalState * selected = switchTerminal(terminals[0]);
+    terminal->lines = LINES;
+    terminal->columns = COLS;
+    std::vector<short> colors;
+    for(short pair = 8; pair < COLOR_PAIRS && pair < 256; pair++) {
+        short foreground, background;
+        if(pair_content(pair, &foreground, &background) == OK) {
+            colors.insert(colors.end(), { pair, foreground, background });
+        }
+    }
+
+    if(type.empty()) {
+        const char * environment = getenv("TERM");
+        type = (environment != NULL) ? environment : "unknown";
+    }
+    SCREEN * screen = newterm(type.c_str(), output, input);
+    if(screen == NULL) {
+        fclose(output);
+        fclose(input);
+        // Don't trust a failed newterm() to have left curses where it was
+        set_term(terminal->screen);
+#if !NCURSES_REENTRANT
+        LINES = terminal->lines;
+        COLS = terminal->columns;
+#endif
+        switchTerminal(selected);
+        return -1;
+    }
+
+    terminals.push_back(new TerminalState(screen, output, input));
+    terminal = terminals.back();
+    setupTerminal();
+
+    for(size_t i = 0; i < colors.size(); i += 3) {
+        init_pair(colors[i], colors[i + 1], colors[i + 2]);
+    }
+    if(mouseEnabled) { setupMouse(); }
+
+    // The new terminal is blank until the app draws on it
+    firstFrame = true;
+    switchTerminal(selected);
+    return (int)terminals.size() - 1;
+}
+
+void Engine::closeTerminal(int index) {
+    // The first terminal lasts as long as the Engine
+    if(index <= 0 || index >= (int)terminals.size() || terminals[index] == NULL) {
+        return;
+    }
+
+    TerminalState * state = terminals[index];
+    TerminalState * selected = switchTerminal(state);
+    teardownTerminal();
+    switchTerminal((selected == state) ? terminals[0] : selected);
+
+    delscreen(state->screen);
+    fclose(state->output);
+    fclose(state->input);
+    delete state;
+    terminals[index] = NULL;
+}
+
+void Engine::selectTerminal(int index) {
+    if(index >= 0 && index < (int)terminals.size()) {
+        switchTerminal(terminals[index]);
+    }
+}
+
+int Engine::getSelectedTerminal() {
+    for(size_t index = 0; index < terminals.size(); index++) {
+        if(terminals[index] == terminal) {
+            return (int)index;
+        }
+    }
+    return -1;
+}
+
+void Engine::flushFrame() {
+    presentAllFrames();
+}
+
+EngineSettings::Backend Engine::getBackend() {
+    return (terminal->directOutput != NULL) ? EngineSettings::DIRECT_BACKEND :
+                                              EngineSettings::CURSES_BACKEND;
+}
+
+void Engine::enableMouse() {
+    TerminalState * selected = terminal;
+    for(TerminalState * state : terminals) {
+        if(state == NULL) { continue; }
+        switchTerminal(state);
+        setupMouse();
+    }
+    switchTerminal(selected);
+    mouseEnabled = true;
+}
+
+void Engine::setupMouse() {
+    mousemask(ALL_MOUSE_EVENTS | REPORT_MOUSE_POSITION, NULL);
+    mouseinterval(0); // Report presses and releases as they happen
+
+    // Ask the terminal to report motion while a button is held down
+    fputs("\033[?1002h", terminal->output);
+    fflush(terminal->output);
+}
+
+/* PANEL */
+Panel::Panel(Box globalDimensionsIn, std::string titleIn, bool hiddenIn) {
+    title = titleIn;
+    externalBorder = false;
+    hidden = hiddenIn;
+    ownsWindow = false;
+    derived = false;
+    parent = NULL;
+    win = NULL;
+    screen = (terminal != NULL) ? terminal->screen : NULL;
+    registryIndex = panelRegistry.add(this, screen, hidden);
+
+    // Calculate sizes based on global dimensions
+    calculateDimensions(globalDimensionsIn);
+
+    // Finally, create the internal window
+    setupWindow();
+}
+
+Panel::Panel(Panel * parentIn, Box globalDimensionsIn, std::string titleIn) {
+    title = titleIn;
+    externalBorder = false;
+    hidden = (parentIn != NULL) && parentIn->hidden;
+    ownsWindow = false;
+    derived = false;
+    parent = parentIn;
+    win = NULL;
+    screen = (terminal != NULL) ? terminal->screen : NULL;
+    registryIndex = panelRegistry.add(this, screen, hidden);
+    if(parent != NULL) {
+        parent->children.push_back(this);
+    }
+
+    calculateDimensions(globalDimensionsIn);
+    setupWindow();
+}
+
+Panel::~Panel() {
+    // Panels inside this one carry on with windows of their own
+    for(Panel * child : children) {
+        child->parent = NULL;
+    }
+    if(parent != NULL) {
+        parent->children.erase(std::find(parent->children.begin(), parent->children.end(), this));
+    }
+
+    // Still listed while the window goes, so anything watching can tell
+    // whose it was
+    teardownWindow();
+    for(Panel * child : children) {
+        if(!child->hidden && !child->ownsWindow) {
+            child->setupWindow();
+            child->invalidate();
+        }
+    }
+    if(panelRegistry.dirty[registryIndex] && !hidden) {
+        invalidatedPanels--;
+    }
+    Panel * moved = panelRegistry.remove(registryIndex);
+    if(moved != NULL) {
+        moved->registryIndex = registryIndex;
+    }
+}
+
+void Panel::calculateDimensions(Box newGlobalDimensions) {
+    globalDimensions = newGlobalDimensions;
+    panelRegistry.bounds[registryIndex] = globalDimensions;
+    lines = globalDimensions.ll.y - globalDimensions.ul.y;
+    columns = globalDimensions.ur.x - globalDimensions.ul.x;
+    windowOrigin = globalDimensions.ul;
+
+    // When someone else draws the border, the window is only the inside
+    if(externalBorder) {
+        lines = (lines > 2) ? lines - 2 : 0;
+        columns = (columns > 2) ? columns - 2 : 0;
+        windowOrigin = Point(globalDimensions.ul.x + 1, globalDimensions.ul.y + 1);
+    }
+
+    // Use sizes in creating local dimensions
+    Point ul(0, 0); Point lr(columns, lines);
+    localDimensions = Box(ul, lr);
+}
+
+void Panel::setupWindow() {
+    TerminalState * state = findTerminal(screen);
+    win = (state != NULL) ? state->placeholder : NULL;
+    ownsWindow = false;
+    if(hidden || lines < 0 || columns < 0) { return; }
+
+    TerminalState * selected = switchTerminal(state);
+    WINDOW * made = NULL;
+    if(parent != NULL && parent->ownsWindow && !parent->hidden && parent->screen == screen) {
+        // derwin() refuses anything that doesn't fit inside the parent
+        made = derwin(parent->win, lines + 1, columns + 1,
+                      windowOrigin.y - parent->windowOrigin.y,
+                      windowOrigin.x - parent->windowOrigin.x);
+        derived = made != NULL;
+    }
+    if(made == NULL) {
+        made = newwin(lines + 1, columns + 1, windowOrigin.y, windowOrigin.x);
+    }
+    if(made != NULL) {
+        win = made;
+        ownsWindow = true;
+
+        // On a slow link, moving content by inserting and deleting lines is
+        // much cheaper than redrawing it
+        idlok(win, lowBandwidth);
+    }
+    switchTerminal(selected);
+
+    // Panels inside can now be views into the new window. Like any new
+    // window, theirs start out blank, so they need drawing again.
+    if(ownsWindow) {
+        for(Panel * child : children) {
+            if(!child->hidden) {
+                child->replaceWindow();
+                child->invalidate();
+            }
+        }
+    }
+}
+
+void Panel::teardownWindow() {
+    // curses won't delete a window while there are views into it
+    for(Panel * child : children) {
+        if(child->derived) {
+            child->teardownWindow();
+        }
+    }
+
+    TerminalState * state = findTerminal(screen);
+    if(ownsWindow) {
+        if(state != NULL) {
+            state->synced.erase(std::remove(state->synced.begin(), state->synced.end(), win),
+                                state->synced.end());
+        }
+        TerminalState * selected = switchTerminal(state);
+        delwin(win);
+        switchTerminal(selected);
+    }
+    win = (state != NULL) ? state->placeholder : NULL;
+    ownsWindow = false;
+    derived = false;
+    forgetHiddenPanel(this);
+}
+
+void Panel::drawPanel() {
+    drawBorder();
+    drawTitle();
+    refreshWindow();
+}
+
+void Panel::drawBorder() {
+    if(externalBorder) { return; }
+
+    Theme * theme = Theme::getActive();
+    int attr = (theme != NULL) ? theme->attribute(Theme::BORDER) : A_NORMAL;
+    setAttributes(attr, win);
+    drawBox(localDimensions, win);
+    unsetAttributes(attr, win);
+}
+
+void Panel::drawTitle() {
+    if(externalBorder) { return; }
+
+    Theme * theme = Theme::getActive();
+    int attr = (theme != NULL) ? theme->attribute(Theme::TITLE) : A_NORMAL;
+    Point titlePoint(columns / 2, 0);
+    setAttributes(attr, win);
+    drawCenteredStringAtPoint(title, titlePoint, win);
+    unsetAttributes(attr, win);
+}
+
+void Panel::refreshWindow() {
+    unsigned char & dirty = panelRegistry.dirty[registryIndex];
+    if(dirty) {
+        dirty = false;
+        if(!hidden) { invalidatedPanels--; }
+    }
+    if(hidden || !ownsWindow) { return; }
+
+    TerminalState * state = findTerminal(screen);
+    TerminalState * selected = switchTerminal(state);
+    if(derived) {
+        // The changes are already in the parent's cells, but curses only
+        // sends the lines it was told about
+        wsyncup(win);
+        Panel * root = parent;
+        while(root->derived) {
+            root = root->parent;
+        }
+        if(state == NULL) {
+            wnoutrefresh(root->win);
+        } else if(std::find(state->synced.begin(), state->synced.end(), root->win) ==
+                  state->synced.end()) {
+            state->synced.push_back(root->win);
+        }
+        chargePanel(title, windowOrigin);
+        switchTerminal(selected);
+        return;
+    }
+
+    // Either backend sends the whole frame at once, in a single
+    // synchronized update, when getInput() comes round
+    wnoutrefresh(win);
+    chargePanel(title, windowOrigin);
+    switchTerminal(selected);
+}
+
+void Panel::resizePanel(Box newGlobalDimensions) {
+    calculateDimensions(newGlobalDimensions);
+    resizeWindow();
+}
+
+void Panel::replaceWindow() {
+    teardownWindow();
+    setupWindow();
+}
+
+void Panel::resizeWindow() {
+    // It may fit now, or it may still not
+    if(!ownsWindow) {
+        setupWindow();
+        return;
+    }
+
+    // Views have to be made again wherever they land, and so do any views
+    // into a window that moves. A Panel inside another that only has a
+    // window of its own because it didn't fit tries again for a view, since
+    // it may fit now.
+    bool hasViews = std::any_of(children.begin(), children.end(),
+                                [](Panel * child) { return child->derived; });
+    if(derived || parent != NULL || hasViews) {
+        replaceWindow();
+        return;
+    }
+
+    // Resizing before moving means the window never hangs off the screen
+    TerminalState * selected = switchTerminal(findTerminal(screen));
+    bool resized = wresize(win, lines + 1, columns + 1) != ERR &&
+                   mvwin(win, windowOrigin.y, windowOrigin.x) != ERR;
+    switchTerminal(selected);
+    if(!resized) {
+        replaceWindow();
+        return;
+    }
+
+    // Old borders would otherwise be left behind inside the new area
+    werase(win);
+}
+
+bool Panel::scrollContent(int n) {
+    // The border (when it's ours) stays put, only the inside moves
+    int top = externalBorder ? 0 : 1;
+    int bottom = externalBorder ? lines : lines - 1;
+    int height = bottom - top + 1;
+    int distance = (n > 0) ? n : -n;
+    if(n == 0 || height <= 0 || !ownsWindow) { return false; }
+
+    // The terminal can only scroll whole lines, so the Panel has to span
+    // the screen, and the terminal has to be able to do it at all
+    TerminalState * state = findTerminal(screen);
+    TerminalState * selected = switchTerminal(state);
+    bool hardware = globalDimensions.ul.x == 0 && globalDimensions.lr.x >= COLS - 1 &&
+                    distance < height;
+    if(hardware) {
+        idlok(win, TRUE);
+        hardware = is_idlok(win);
+    }
+    switchTerminal(selected);
+
+    // Lines scrolled in need the sides of the border, whatever it looks like
+    chtype left = 0, right = 0;
+    if(!externalBorder) {
+        left = mvwinch(win, top, 0);
+        right = mvwinch(win, top, columns);
+    }
+
+    scrollok(win, TRUE);
+    wsetscrreg(win, top, bottom);
+    wscrl(win, n);
+    wsetscrreg(win, 0, lines);
+    scrollok(win, FALSE);
+
+    if(!externalBorder) {
+        int first = (n > 0) ? std::max(bottom - distance + 1, top) : top;
+        int last = (n > 0) ? bottom : std::min(top + distance - 1, bottom);
+        for(int y = first; y <= last; y++) {
+            mvwaddch(win, y, 0, left);
+            mvwaddch(win, y, columns, right);
+        }
+    }
+
+    if(hardware && state != NULL && state->directOutput != NULL) {
+        state->directOutput->scrolled(windowOrigin.y + top, windowOrigin.y + bottom, n);
+    }
+
+    return hardware;
+}
+
+void Panel::clearScreen() {
+    clearBox(localDimensions, win);
+}
+
+WINDOW * Panel::getWin() {
+    return win;
+}
+
+Panel * Panel::getParent() {
+    return parent;
+}
+
+void Panel::setTitle(std::string newTitle) {
+    title = newTitle;
+}
+
+const std::string & Panel::getTitle() {
+    return title;
+}
+
+Box Panel::getDimensions() {
+    return globalDimensions;
+}
+
+void Panel::invalidate() {
+    unsigned char & dirty = panelRegistry.dirty[registryIndex];
+    if(!dirty) {
+        dirty = true;
+        if(!hidden) { invalidatedPanels++; }
+    }
+}
+
+bool Panel::isInvalidated() {
+    return panelRegistry.dirty[registryIndex];
+}
+
+void Panel::setZOrder(int z) {
+    panelRegistry.zOrders[registryIndex] = z;
+}
+
+int Panel::getZOrder() {
+    return panelRegistry.zOrders[registryIndex];
+}
+
+void Panel::hide() {
+    if(hidden) { return; }
+
+    hidden = true;
+    panelRegistry.shown[registryIndex] = false;
+    if(panelRegistry.dirty[registryIndex]) { invalidatedPanels--; }
+    if(ownsWindow) {
+        hiddenPanels.push_back({this, std::chrono::steady_clock::now()});
+    }
+    for(Panel * child : children) {
+        child->hide();
+    }
+}
+
+void Panel::show() {
+    if(!hidden) { return; }
+
+    hidden = false;
+    panelRegistry.shown[registryIndex] = true;
+    if(panelRegistry.dirty[registryIndex]) { invalidatedPanels++; }
+    forgetHiddenPanel(this);
+
+    // A window kept while hidden still has what was drawn on it, but a new
+    // one needs drawing from scratch
+    if(ownsWindow) {
+        touchwin(win);
+    } else {
+        setupWindow();
+        invalidate();
+    }
+    for(Panel * child : children) {
+        child->show();
+    }
+}
+
+bool Panel::isHidden() {
+    return hidden;
+}
+
+bool Panel::hasWindow() {
+    return ownsWindow;
+}
+
+size_t Panel::getMemoryUsage() {
+    return sizeof(Panel) + stringMemoryUsage(title) + (ownsWindow ? windowMemoryUsage(win) : 0);
+}
+
+void Panel::releaseCaches() {
+    if(hidden) {
+        teardownWindow();
+
+        // Any shown since still need somewhere to draw
+        for(Panel * child : children) {
+            if(!child->hidden && !child->ownsWindow) {
+                child->setupWindow();
+                child->invalidate();
+            }
+        }
+    }
+}
+
+void Panel::setExternalBorder(bool external) {
+    if(external == externalBorder) { return; }
+
+    externalBorder = external;
+    resizePanel(globalDimensions);
+}
+
+/* FORM */
+Form::Form(Point origin) :
+    origin(origin), prompt(""), promptLength((int)prompt.size()), buffer("") {
+    lines = 1; columns = COLS - (promptLength + 2);
+    win = newwin(lines, COLS - 1, origin.y, origin.x);
+    keypad(win, TRUE);
+    screen = (terminal != NULL) ? terminal->screen : NULL;
+    liveForms.push_back({screen, this});
+}
+
+Form::Form(Point origin, int length) :
+    origin(origin), prompt(""), promptLength((int)prompt.size()), buffer("") {
+    lines = 1; columns = length - (promptLength + 1);
+    win = newwin(lines, length, origin.y, origin.x);
+    keypad(win, TRUE);
+    screen = (terminal != NULL) ? terminal->screen : NULL;
+    liveForms.push_back({screen, this});
+}
+
+Form::Form(Point origin, std::string prompt) :
+    origin(origin), prompt(prompt), promptLength((int)prompt.size()), buffer("") {
+    lines = 1; columns = COLS - (promptLength + 2);
+    win = newwin(lines, COLS - 1, origin.y, origin.x);
+    keypad(win, TRUE);
+    screen = (terminal != NULL) ? terminal->screen : NULL;
+    liveForms.push_back({screen, this});
+}
+
+Form::Form(Point origin, int length, std::string prompt) :
+    origin(origin), prompt(prompt), promptLength((int)prompt.size()), buffer("") {
+    lines = 1; columns = length - (promptLength + 1);
+    win = newwin(lines, length, origin.y, origin.x);
+    keypad(win, TRUE);
+    screen = (terminal != NULL) ? terminal->screen : NULL;
+    liveForms.push_back({screen, this});
+}
+
+Form::~Form() {
+    liveForms.erase(std::find(liveForms.begin(), liveForms.end(), std::make_pair(screen, this)));
+    TerminalState * selected = switchTerminal(findTerminal(screen));
+    delwin(win);
+    switchTerminal(selected);
+}
+
+WINDOW * Form::getWin() {
+    return win;
+}
+
+size_t Form::getMemoryUsage() {
+    return sizeof(Form) + stringMemoryUsage(prompt) + stringMemoryUsage(buffer) +
+           windowMemoryUsage(win);
+}
+
+void Form::drawForm() {
+    clearForm();
+    drawPrompt();
+    drawBuffer();
+}
+
+void Form::clearForm() {
+    Point ul(promptLength + 1, 0);
+    Point lr(columns + (promptLength + 1), 0);
+    Box formBox(ul, lr);
+    clearBox(formBox, win);
+}
+
+void Form::drawPrompt() {
+    Point promptPoint(0, 0);
+    drawStringAtPoint(prompt, promptPoint, win);
+}
+
+void Form::drawBuffer() {
+    // Only the tail of the buffer fits, so start drawing partway in
+    int bufferSize = (int)buffer.size();
+    int formLength = columns;
+    int first = (bufferSize >= formLength) ? bufferSize - formLength : 0;
+
+    wmove(win, 0, promptLength + 1);
+    waddnstr(win, buffer.c_str() + first, bufferSize - first);
+}
+
+void Form::injectString(std::string str) {
+    for(char ch : str) {
+        addCharToBuffer(ch);
+    }
+}
+
+void Form::addCharToBuffer(char ch) {
+    buffer.push_back(ch);
+}
+
+void Form::removeCharFromBuffer() {
+    if(!buffer.empty()) {
+        buffer.pop_back();
+    }
+}
+
+std::string Form::edit() {
+    // What frame budget reports call us, without building a new string
+    static const std::string untitled = "Form";
+
+    // Everything happens on the Form's own terminal, whichever is selected
+    TerminalState * selected = switchTerminal(findTerminal(screen));
+
+    // Make cursor visible while typing
+    curs_set(1);
+
+    int ch;
+    bool exit = false;
+    while(!exit) {
+        drawForm();
+        ch = getInput(win);
+        switch(ch) {
+            case 10: // Enter Key (submit)
+            case KEY_F(1): // Cancel form input
+                exit = true;
+                break;
+            case ERR: // Woken up by a timer or the like, nothing was typed
+                break;
+            default: // Delegate to form driver
+                handleInput(ch);
+                Engine::chargeFrameTime(prompt.empty() ? untitled : prompt);
+                break;
+        }
+    }
+
+    // Make cursor invisible after typing
+    curs_set(0);
+    switchTerminal(selected);
+
+    return trimWhitespace(buffer);
+}
+
+void Form::handleInput(int ch) {
+    switch(ch) {
+        case KEY_BACKSPACE:
+        case 127: // Backspace Key
+            removeCharFromBuffer();
+            break;
+        default: // Normal character
+            addCharToBuffer(ch);
+            break;
+    }
+}
+
+std::string Form::trimWhitespace(std::string str) {
+    size_t first = str.find_first_not_of(' ');
+	if(std::string::npos == first) {
+		return str;
+	}
+
+	size_t last = str.find_last_not_of(' ');
+
+	return str.substr(first, (last - first + 1));
+}
+
+///////////////////////////// LAYOUT UTILITIES ///////////////////////////////
+
+/* LAYOUT TREE */
+const int LayoutTree::minimumSlotSize;
+
+LayoutTree::LayoutTree(Orientation orientation, std::string ratio) :
+    hasDimensions(false), sharedBorders(false), generation(0), dragging(false), dragPending(false),
+    dragSplit(0), dragBorder(0) {
+    Split root;
+    root.orientation = orientation;
+    for(int num : Layouts::parseRatio(ratio)) {
+        root.slots.push_back({num, 0, -1, NULL, Box()});
+    }
+
+    splits.push_back(root);
+}
+
+int LayoutTree::addSplit(int split, int slot, Orientation orientation, std::string ratio) {
+    Split child;
+    child.orientation = orientation;
+    for(int num : Layouts::parseRatio(ratio)) {
+        child.slots.push_back({num, 0, -1, NULL, Box()});
+    }
+
+    splits.push_back(child);
+    int index = (int)splits.size() - 1;
+    splits[split].slots[slot].child = index;
+    splits[split].slots[slot].panel = NULL;
+
+    return index;
+}
+
+void LayoutTree::attachPanel(int split, int slot, Panel * panel) {
+    splits[split].slots[slot].child = -1;
+    splits[split].slots[slot].panel = panel;
+    panel->setExternalBorder(sharedBorders);
+}
+
+void LayoutTree::setMinimumSize(int split, int slot, int minimum) {
+    splits[split].slots[slot].minimum = minimum;
+}
+
+void LayoutTree::replace(const LayoutTree & other) {
+    splits = other.splits;
+
+    // Keep our own border mode, and make sure the new Panels follow it
+    for(Panel * panel : getPanels()) {
+        panel->setExternalBorder(sharedBorders);
+    }
+
+    layout();
+}
+
+void LayoutTree::layout(Box * dimensionsIn) {
+    if(dimensionsIn != NULL) {
+        dimensions = *dimensionsIn;
+        hasDimensions = true;
+    }
+
+    Box bounds = hasDimensions ? dimensions : Box();
+    layoutSplit(0, bounds);
+    generation++;
+
+    // Anything we had queued up was relative to the old layout
+    dragging = false;
+    dragPending = false;
+}
+
+void LayoutTree::layoutSplit(int index, Box bounds) {
+    Split & split = splits[index];
+    split.bounds = bounds;
+
+    std::vector<int> nums;
+    nums.reserve(split.slots.size());
+    for(Slot & slot : split.slots) {
+        nums.push_back(slot.weight);
+    }
+
+    std::vector<Box> boxes;
+    if(split.orientation == HORIZONTAL) {
+        boxes = Layouts::customHLayout(nums, &bounds);
+        // Rounding can leave a gap at the end, so the last slot soaks it up
+        boxes.back().ur.x = bounds.ur.x;
+        boxes.back().lr.x = bounds.lr.x;
+    } else {
+        boxes = Layouts::customVLayout(nums, &bounds);
+        boxes.back().ll.y = bounds.ll.y;
+        boxes.back().lr.y = bounds.lr.y;
+    }
+
+    applyMinimums(split, boxes, bounds);
+
+    // Stretch each slot over the first row/column of the next one
+    if(sharedBorders) {
+        for(size_t i = 0; i + 1 < boxes.size(); i++) {
+            if(split.orientation == HORIZONTAL) {
+                boxes[i].ur.x = boxes[i].lr.x = boxes[i + 1].ul.x;
+            } else {
+                boxes[i].ll.y = boxes[i].lr.y = boxes[i + 1].ul.y;
+            }
+        }
+    }
+
+    for(size_t i = 0; i < boxes.size(); i++) {
+        layoutSlot(split.slots[i], boxes[i]);
+    }
+}
+
+void LayoutTree::applyMinimums(Split & split, std::vector<Box> & boxes, Box bounds) {
+    bool horizontal = split.orientation == HORIZONTAL;
+    std::vector<int> sizes;
+    bool tooSmall = false;
+    for(size_t i = 0; i < boxes.size(); i++) {
+        int size = horizontal ? (boxes[i].lr.x - boxes[i].ul.x + 1)
+                              : (boxes[i].lr.y - boxes[i].ul.y + 1);
+        sizes.push_back(size);
+        tooSmall = tooSmall || size < split.slots[i].minimum;
+    }
+    if(!tooSmall) { return; }
+
+    for(size_t i = 0; i < sizes.size(); i++) {
+        int need = split.slots[i].minimum - sizes[i];
+        while(need > 0) {
+            // Take from whichever sibling has the most room to spare
+            int donor = -1, spare = 0;
+            for(size_t j = 0; j < sizes.size(); j++) {
+                int floor = std::max(split.slots[j].minimum, 1);
+                if(j != i && sizes[j] - floor > spare) {
+                    donor = j;
+                    spare = sizes[j] - floor;
+                }
+            }
+            if(donor < 0) { break; }
+
+            int taken = std::min(need, spare);
+            sizes[donor] -= taken;
+            sizes[i] += taken;
+            need -= taken;
+        }
+    }
+
+    // Rebuild the Boxes end to end from the new sizes
+    int position = horizontal ? bounds.ul.x : bounds.ul.y;
+    for(size_t i = 0; i < boxes.size(); i++) {
+        if(horizontal) {
+            boxes[i].ul.x = boxes[i].ll.x = position;
+            boxes[i].ur.x = boxes[i].lr.x = position + sizes[i] - 1;
+        } else {
+            boxes[i].ul.y = boxes[i].ur.y = position;
+            boxes[i].ll.y = boxes[i].lr.y = position + sizes[i] - 1;
+        }
+        position += sizes[i];
+    }
+}
+
+void LayoutTree::layoutSlot(Slot & slot, Box bounds) {
+    slot.bounds = bounds;
+    if(slot.child >= 0) {
+        layoutSplit(slot.child, bounds);
+    } else if(slot.panel != NULL &&
+              !Box::boxesAreEqual(slot.panel->getDimensions(), bounds)) {
+        // Panels that haven't moved keep their window and contents
+        slot.panel->resizePanel(bounds);
+    }
+}
+
+bool LayoutTree::findBorder(Point p, int & split, int & border) {
+    for(size_t s = 0; s < splits.size(); s++) {
+        Split & current = splits[s];
+        for(size_t i = 0; i + 1 < current.slots.size(); i++) {
+            Box & a = current.slots[i].bounds;
+            Box & b = current.slots[i + 1].bounds;
+
+            // The border is the edge of either slot facing the other
+            bool hit;
+            if(current.orientation == HORIZONTAL) {
+                hit = (p.x == a.lr.x || p.x == b.ul.x) &&
+                      p.y >= current.bounds.ul.y && p.y <= current.bounds.lr.y;
+            } else {
+                hit = (p.y == a.lr.y || p.y == b.ul.y) &&
+                      p.x >= current.bounds.ul.x && p.x <= current.bounds.lr.x;
+            }
+
+            if(hit) {
+                split = (int)s;
+                border = (int)i;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool LayoutTree::handleMouse(const MEVENT & event) {
+    Point p(event.x, event.y);
+
+    if(event.bstate & BUTTON1_PRESSED) {
+        dragging = findBorder(p, dragSplit, dragBorder);
+        return dragging;
+    }
+
+    if(!dragging) { return false; }
+
+    // Only remember where the mouse is; update() does the actual work
+    dragPoint = p;
+    dragPending = true;
+    if(event.bstate & BUTTON1_RELEASED) {
+        dragging = false;
+    }
+
+    return true;
+}
+
+bool LayoutTree::update() {
+    if(!dragPending) { return false; }
+
+    dragPending = false;
+    return applyDrag();
+}
+
+bool LayoutTree::applyDrag() {
+    Split & split = splits[dragSplit];
+    Slot & a = split.slots[dragBorder];
+    Slot & b = split.slots[dragBorder + 1];
+
+    bool horizontal = split.orientation == HORIZONTAL;
+    int start = horizontal ? a.bounds.ul.x : a.bounds.ul.y;
+    int end = horizontal ? b.bounds.lr.x : b.bounds.lr.y;
+    int current = horizontal ? a.bounds.lr.x : a.bounds.lr.y;
+    int target = horizontal ? dragPoint.x : dragPoint.y;
+
+    // Shared borders mean the second slot starts on the border itself
+    int overlap = sharedBorders ? 0 : 1;
+
+    // Keep both slots at least minimumSlotSize cells (or their minimum) big
+    int low = start + std::max(minimumSlotSize, a.minimum) - 1;
+    int high = end - std::max(minimumSlotSize, b.minimum) + 1 - overlap;
+    if(low > high) { return false; }
+    if(target < low) { target = low; }
+    if(target > high) { target = high; }
+    if(target == current) { return false; }
+
+    Box newA = a.bounds;
+    Box newB = b.bounds;
+    if(horizontal) {
+        newA.ur.x = newA.lr.x = target;
+        newB.ul.x = newB.ll.x = target + overlap;
+    } else {
+        newA.ll.y = newA.lr.y = target;
+        newB.ul.y = newB.ur.y = target + overlap;
+    }
+
+    // Weights become cell sizes, so a later full layout keeps the drag
+    for(Slot & slot : split.slots) {
+        Box & bounds = (&slot == &a) ? newA : (&slot == &b) ? newB : slot.bounds;
+        slot.weight = horizontal ? (bounds.lr.x - bounds.ul.x + 1)
+                                 : (bounds.lr.y - bounds.ul.y + 1);
+    }
+
+    layoutSlot(a, newA);
+    layoutSlot(b, newB);
+    generation++;
+
+    return true;
+}
+
+const std::vector<Panel *> & LayoutTree::getPanels() {
+    panels.clear();
+    for(Split & split : splits) {
+        for(Slot & slot : split.slots) {
+            if(slot.panel != NULL) {
+                panels.push_back(slot.panel);
+            }
+        }
+    }
+
+    return panels;
+}
+
+const std::vector<LayoutTree::Leaf> & LayoutTree::getLeaves() {
+    leaves.clear();
+    for(Split & split : splits) {
+        for(Slot & slot : split.slots) {
+            if(slot.child < 0) {
+                leaves.push_back({slot.bounds, slot.panel});
+            }
+        }
+    }
+
+    return leaves;
+}
+
+void LayoutTree::setSharedBorders(bool shared) {
+    sharedBorders = shared;
+    for(Panel * panel : getPanels()) {
+        panel->setExternalBorder(shared);
+    }
+
+    layout();
+}
+
+bool LayoutTree::hasSharedBorders() {
+    return sharedBorders;
+}
+
+int LayoutTree::getGeneration() {
+    return generation;
+}
+
+/* BORDER COMPOSITOR */
+BorderCompositor::BorderCompositor(LayoutTree * layoutIn) :
+    layout(layoutIn), drawnGeneration(-1), drawnThemeGeneration(-1),
+    edgeColumns(0), edgeLines(0) {
+    layout->setSharedBorders(true);
+}
+
+BorderCompositor::~BorderCompositor() {
+    layout->setSharedBorders(false);
+}
+
+void BorderCompositor::markCell(int x, int y, unsigned char bits) {
+    if(x < 0 || y < 0 || x >= edgeColumns || y >= edgeLines) { return; }
+
+    unsigned char & cell = edges[y * edgeColumns + x];
+    if(cell == 0) {
+        borderCells.push_back(y * edgeColumns + x);
+    }
+    cell |= bits;
+}
+
+void BorderCompositor::markBox(Box b) {
+    // Top and bottom edges connect west and east (except at the ends)
+    for(int x = b.ul.x; x <= b.ur.x; x++) {
+        unsigned char bits = ((x > b.ul.x) ? WEST : 0) | ((x < b.ur.x) ? EAST : 0);
+        markCell(x, b.ul.y, bits);
+        markCell(x, b.ll.y, bits);
+    }
+
+    // Left and right edges connect north and south (except at the ends)
+    for(int y = b.ul.y; y <= b.ll.y; y++) {
+        unsigned char bits = ((y > b.ul.y) ? NORTH : 0) | ((y < b.ll.y) ? SOUTH : 0);
+        markCell(b.ul.x, y, bits);
+        markCell(b.ur.x, y, bits);
+    }
+}
+
+chtype BorderCompositor::glyphForEdges(unsigned char bits) {
+    switch(bits) {
+        case SOUTH | EAST:                  return ACS_ULCORNER;
+        case SOUTH | WEST:                  return ACS_URCORNER;
+        case NORTH | EAST:                  return ACS_LLCORNER;
+        case NORTH | WEST:                  return ACS_LRCORNER;
+        case NORTH | SOUTH | EAST:          return ACS_LTEE;
+        case NORTH | SOUTH | WEST:          return ACS_RTEE;
+        case WEST | EAST | SOUTH:           return ACS_TTEE;
+        case WEST | EAST | NORTH:           return ACS_BTEE;
+        case NORTH | SOUTH | WEST | EAST:   return ACS_PLUS;
+        case NORTH:
+        case SOUTH:
+        case NORTH | SOUTH:                 return ACS_VLINE;
+        default:                            return ACS_HLINE;
+    }
+}
+
+bool BorderCompositor::titlesChanged(const std::vector<LayoutTree::Leaf> & leaves) {
+    if(drawnTitles.size() != leaves.size()) { return true; }
+
+    for(size_t i = 0; i < leaves.size(); i++) {
+        Panel * panel = leaves[i].panel;
+        if(panel != NULL && panel->getTitle() != drawnTitles[i]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool BorderCompositor::draw(bool force) {
+    const std::vector<LayoutTree::Leaf> & leaves = layout->getLeaves();
+    Theme * theme = Theme::getActive();
+    int themeGeneration = (theme != NULL) ? theme->getGeneration() : -1;
+    if(!force && layout->getGeneration() == drawnGeneration &&
+       themeGeneration == drawnThemeGeneration && !titlesChanged(leaves)) {
+        return false;
+    }
+
+    // Blank out whatever we drew last time, the layout may have moved it.
+    // Cells the terminal has shrunk away from are gone already, and trying
+    // to move there would leave the space wherever the cursor was instead.
+    int maxX, maxY;
+    getmaxyx(stdscr, maxY, maxX);
+    for(int cell : borderCells) {
+        int x = cell % edgeColumns, y = cell / edgeColumns;
+        if(x >= maxX || y >= maxY) { continue; }
+        drawCharAtPoint(' ', Point(x, y));
+    }
+
+    edgeColumns = maxX;
+    edgeLines = maxY;
+    edges.assign(edgeColumns * edgeLines, 0);
+    borderCells.clear();
+
+    for(const LayoutTree::Leaf & leaf : leaves) {
+        markBox(leaf.bounds);
+    }
+
+    // Every border cell is drawn exactly once, however many Panels share it
+    int borderAttr = (theme != NULL) ? theme->attribute(Theme::BORDER) : A_NORMAL;
+    for(int cell : borderCells) {
+        mvaddch(cell / edgeColumns, cell % edgeColumns,
+                glyphForEdges(edges[cell]) | borderAttr);
+    }
+
+    // Titles sit on the top edge, trimmed so they never eat the corners
+    drawnTitles.clear();
+    for(const LayoutTree::Leaf & leaf : leaves) {
+        std::string title = (leaf.panel != NULL) ? leaf.panel->getTitle() : "";
+        drawnTitles.push_back(title);
+
+        int width = leaf.bounds.ur.x - leaf.bounds.ul.x - 1;
+        if(width <= 0 || title.empty()) { continue; }
+        if((int)title.size() > width) {
+            title = title.substr(0, width);
+        }
+
+        int middle = leaf.bounds.ul.x + (leaf.bounds.ur.x - leaf.bounds.ul.x) / 2;
+        int start = middle - (int)title.size() / 2;
+        if(start <= leaf.bounds.ul.x) { start = leaf.bounds.ul.x + 1; }
+
+        int titleAttr = (theme != NULL) ? theme->attribute(Theme::TITLE) : A_NORMAL;
+        setAttributes(titleAttr);
+        drawStringAtPoint(title, Point(start, leaf.bounds.ul.y));
+        unsetAttributes(titleAttr);
+    }
+
+    wnoutrefresh(stdscr);
+
+    // Copying stdscr may have covered Panels, so make sure they go back on top
+    for(const LayoutTree::Leaf & leaf : leaves) {
+        if(leaf.panel != NULL) {
+            touchwin(leaf.panel->getWin());
+        }
+    }
+
+    drawnGeneration = layout->getGeneration();
+    drawnThemeGeneration = themeGeneration;
+    return true;
+}
+
+/* RESPONSIVE LAYOUT */
+ResponsiveLayout::ResponsiveLayout() : active(-1) {}
+
+void ResponsiveLayout::addBreakpoint(int minColumns, int minLines, LayoutTree * layout) {
+    // The terminal is never smaller than nothing, and the lookup tables
+    // need at least one size in them
+    breakpoints.push_back({std::max(minColumns, 0), std::max(minLines, 0), layout});
+    compile();
+}
+
+void ResponsiveLayout::compile() {
+    // Every distinct threshold splits sizes into another class
+    columnThresholds.clear();
+    lineThresholds.clear();
+    for(Breakpoint & b : breakpoints) {
+        columnThresholds.push_back(b.minColumns);
+        lineThresholds.push_back(b.minLines);
+    }
+
+    for(std::vector<int> * t : {&columnThresholds, &lineThresholds}) {
+        std::sort(t->begin(), t->end());
+        t->erase(std::unique(t->begin(), t->end()), t->end());
+    }
+
+    // Map every size up to the largest threshold onto its class
+    columnClass.assign(columnThresholds.back() + 1, 0);
+    for(int size = 0; size < (int)columnClass.size(); size++) {
+        columnClass[size] = std::upper_bound(columnThresholds.begin(),
+                columnThresholds.end(), size) - columnThresholds.begin();
+    }
+    lineClass.assign(lineThresholds.back() + 1, 0);
+    for(int size = 0; size < (int)lineClass.size(); size++) {
+        lineClass[size] = std::upper_bound(lineThresholds.begin(),
+                lineThresholds.end(), size) - lineThresholds.begin();
+    }
+
+    // Then decide the winning breakpoint for every pair of classes
+    int columnClasses = columnThresholds.size() + 1;
+    int lineClasses = lineThresholds.size() + 1;
+    classTable.assign(columnClasses * lineClasses, 0);
+    for(int c = 0; c < columnClasses; c++) {
+        int columns = (c == 0) ? -1 : columnThresholds[c - 1];
+        for(int l = 0; l < lineClasses; l++) {
+            int lines = (l == 0) ? -1 : lineThresholds[l - 1];
+            int winner = 0;
+            for(size_t i = 0; i < breakpoints.size(); i++) {
+                if(columns >= breakpoints[i].minColumns && lines >= breakpoints[i].minLines) {
+                    winner = i;
+                }
+            }
+            classTable[c * lineClasses + l] = winner;
+        }
+    }
+}
+
+int ResponsiveLayout::lookup(int columns, int lines) {
+    int c = columnClass[std::min(std::max(columns, 0), (int)columnClass.size() - 1)];
+    int l = lineClass[std::min(std::max(lines, 0), (int)lineClass.size() - 1)];
+    return classTable[c * (lineThresholds.size() + 1) + l];
+}
+
+bool ResponsiveLayout::resize() {
+    if(breakpoints.empty()) { return false; }
+
+    int chosen = lookup(COLS, LINES);
+    bool changed = chosen != active;
+    LayoutTree * layout = breakpoints[chosen].layout;
+
+    if(changed) {
+        // Panels only in the other layouts won't be drawn, so they can let
+        // go of their windows after a while
+        for(Breakpoint & breakpoint : breakpoints) {
+            if(breakpoint.layout == layout) { continue; }
+            for(Panel * panel : breakpoint.layout->getPanels()) {
+                panel->hide();
+            }
+        }
+
+        // Panels may be shared with the old layout, which could have had a
+        // different border mode, and its borders are no longer wanted
+        bool shared = layout->hasSharedBorders();
+        for(Panel * panel : layout->getPanels()) {
+            panel->show();
+            panel->setExternalBorder(shared);
+        }
+        erase();
+        active = chosen;
+    }
+
+    layout->layout();
+
+    // Panels that kept their bounds weren't redrawn, but stdscr was erased
+    if(changed) {
+        for(Panel * panel : layout->getPanels()) {
+            touchwin(panel->getWin());
+        }
+    }
+
+    return changed;
+}
+
+LayoutTree * ResponsiveLayout::getActive() {
+    return (active >= 0) ? breakpoints[active].layout : NULL;
+}
+
+const std::vector<Panel *> & ResponsiveLayout::getActivePanels() {
+    static const std::vector<Panel *> none;
+
+    LayoutTree * layout = getActive();
+    return (layout != NULL) ? layout->getPanels() : none;
+}
+
+/* FILE WATCHER */
+FileWatcher::FileWatcher(std::string path) : fd(-1), watch(-1), pending(false) {
+    size_t slash = path.find_last_of('/');
+    directory = (slash == std::string::npos) ? "." : path.substr(0, slash);
+    filename = (slash == std::string::npos) ? path : path.substr(slash + 1);
+    if(directory.empty()) { directory = "/"; }
+
+#ifdef __linux__
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(fd >= 0) {
+        watch = inotify_add_watch(fd, directory.c_str(),
+                                  IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    }
+#endif
+
+    // Changes to our file wake getInput(), so whoever owns us gets to poll.
+    // Anything else in the directory is drained without waking anyone.
+    if(watch >= 0) {
+        Engine::watchFd(fd, [this]() {
+            pending = drain() || pending;
+            return pending;
+        });
+    }
+}
+
+FileWatcher::~FileWatcher() {
+    if(fd >= 0) {
+        Engine::unwatchFd(fd);
+        close(fd);
+    }
+}
+
+bool FileWatcher::changed() {
+    bool found = drain() || pending;
+    pending = false;
+    return found;
+}
+
+bool FileWatcher::drain() {
+    bool found = false;
+#ifdef __linux__
+    if(fd < 0 || watch < 0) { return false; }
+
+    // Drain every queued event, since one save can produce several
+    alignas(struct inotify_event) char events[4096];
+    ssize_t length;
+    while((length = read(fd, events, sizeof(events))) > 0) {
+        for(char * p = events; p < events + length; ) {
+            struct inotify_event * event = (struct inotify_event *)p;
+            if(event->len > 0 && filename == event->name) {
+                found = true;
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+#endif
+    return found;
+}
+
+int FileWatcher::getFd() {
+    return fd;
+}
+
+/* LAYOUT FILE */
+LayoutFile::LayoutFile(std::string pathIn) :
+    path(pathIn), layout(NULL), watcher(NULL) {}
+
+LayoutFile::~LayoutFile() {
+    delete watcher;
+    delete layout;
+    for(Panel * panel : ownedPanels) {
+        delete panel;
+    }
+}
+
+void LayoutFile::registerPanel(std::string name, Panel * panel) {
+    panels[name] = panel;
+}
+
+Panel * LayoutFile::findOrCreatePanel(const std::string & name) {
+    auto iter = panels.find(name);
+    if(iter != panels.end()) {
+        return iter->second;
+    }
+
+    Panel * panel = new Panel(Box());
+    panels[name] = panel;
+    ownedPanels.push_back(panel);
+    return panel;
+}
+
+// Split a line into words, keeping "quoted strings" together
+static std::vector<std::string> tokenizeLayoutLine(const std::string & line) {
+    std::vector<std::string> tokens;
+    size_t i = 0;
+    while(i < line.size()) {
+        if(isspace(line[i])) {
+            i++;
+        } else if(line[i] == '"') {
+            size_t end = line.find('"', i + 1);
+            if(end == std::string::npos) { end = line.size(); }
+            tokens.push_back(line.substr(i, end - i));
+            i = end + 1;
+        } else {
+            size_t end = i;
+            while(end < line.size() && !isspace(line[end])) { end++; }
+            tokens.push_back(line.substr(i, end - i));
+            i = end;
+        }
+    }
+
+    return tokens;
+}
+
+LayoutTree * LayoutFile::parse() {
+    std::ifstream file(path);
+    if(!file) {
+        throw InvalidLayoutException("Could not open layout file " + path + ".");
+    }
+
+    // Each open split remembers its indentation and the next slot to fill
+    struct Open { int indent; int split; int nextSlot; int slots; int line; };
+    std::vector<Open> open;
+    LayoutTree * tree = NULL;
+
+    // Panels are only made, attached and titled once the whole file turns
+    // out to be valid, so a bad file leaves nothing behind
+    struct Attachment { int split; int slot; std::string name; bool hasTitle; std::string title; };
+    std::vector<Attachment> attachments;
+
+    // A split has to be completely filled in by the time it closes
+    auto close = [](const Open & split) {
+        if(split.nextSlot < split.slots) {
+            throw InvalidLayoutException("Line " + std::to_string(split.line) +
+                                         ": Every split needs one child per ratio number.");
+        }
+    };
+
+    std::string line;
+    int number = 0;
+    try {
+        while(std::getline(file, line)) {
+            number++;
+            std::string where = "Line " + std::to_string(number) + ": ";
+
+            size_t indent = line.find_first_not_of(" \t");
+            if(indent == std::string::npos || line[indent] == '#') { continue; }
+
+            std::vector<std::string> tokens = tokenizeLayoutLine(line);
+            const std::string & kind = tokens[0];
+            bool isSplit = (kind == "hsplit" || kind == "vsplit");
+            if(!isSplit && kind != "panel") {
+                throw InvalidLayoutException(where + "Unknown keyword '" + kind + "'.");
+            }
+            if(tokens.size() < 2) {
+                throw InvalidLayoutException(where + "Missing " +
+                        (isSplit ? "ratio" : "panel name") + ".");
+            }
+
+            // Optional title and constraints follow the name/ratio
+            std::string title;
+            bool hasTitle = false;
+            int minimum = 0;
+            for(size_t t = 2; t < tokens.size(); t++) {
+                if(tokens[t][0] == '"') {
+                    title = tokens[t].substr(1);
+                    hasTitle = true;
+                } else if(tokens[t].compare(0, 4, "min=") == 0) {
+                    const char * digits = tokens[t].c_str() + 4;
+                    char * end = NULL;
+                    errno = 0;
+                    long value = strtol(digits, &end, 10);
+                    if(*digits == '\0' || *end != '\0' || errno != 0 ||
+                       value < 0 || value > INT_MAX) {
+                        throw InvalidLayoutException(where + "Bad minimum size '" + tokens[t] + "'.");
+                    }
+                    minimum = (int)value;
+                } else {
+                    throw InvalidLayoutException(where + "Unexpected '" + tokens[t] + "'.");
+                }
+            }
+
+            // Close any splits this line isn't nested inside
+            while(!open.empty() && open.back().indent >= (int)indent) {
+                close(open.back());
+                open.pop_back();
+            }
+
+            LayoutTree::Orientation orientation = (kind == "hsplit") ?
+                LayoutTree::HORIZONTAL : LayoutTree::VERTICAL;
+
+            if(tree == NULL) {
+                if(!isSplit) {
+                    throw InvalidLayoutException(where + "Layouts must start with a split.");
+                }
+                tree = new LayoutTree(orientation, tokens[1]);
+                // Match the live tree's borders so Panels aren't resized twice
+                if(layout != NULL && layout->hasSharedBorders()) {
+                    tree->setSharedBorders(true);
+                }
+                open.push_back({(int)indent, 0, 0,
+                                (int)Layouts::parseRatio(tokens[1]).size(), number});
+                continue;
+            }
+
+            if(open.empty()) {
+                throw InvalidLayoutException(where + "Layouts can only have one root split.");
+            }
+
+            Open & parent = open.back();
+            if(parent.nextSlot >= parent.slots) {
+                throw InvalidLayoutException(where + "Too many children for the split on line " +
+                                             std::to_string(parent.line) + ".");
+            }
+
+            int slot = parent.nextSlot++;
+            tree->setMinimumSize(parent.split, slot, minimum);
+            if(isSplit) {
+                int split = tree->addSplit(parent.split, slot, orientation, tokens[1]);
+                open.push_back({(int)indent, split, 0,
+                                (int)Layouts::parseRatio(tokens[1]).size(), number});
+            } else {
+                for(const Attachment & attachment : attachments) {
+                    if(attachment.name == tokens[1]) {
+                        throw InvalidLayoutException(where + "Panel '" + tokens[1] +
+                                                     "' is already in the layout.");
+                    }
+                }
+                attachments.push_back({parent.split, slot, tokens[1], hasTitle, title});
+            }
+        }
+
+        if(tree == NULL) {
+            throw InvalidLayoutException("Layout file " + path + " is empty.");
+        }
+        while(!open.empty()) {
+            close(open.back());
+            open.pop_back();
+        }
+    } catch(InvalidRatioException& e) {
+        delete tree;
+        throw InvalidLayoutException("Line " + std::to_string(number) + ": " + e.what());
+    } catch(InvalidLayoutException& e) {
+        delete tree;
+        throw;
+    }
+
+    for(const Attachment & attachment : attachments) {
+        Panel * panel = findOrCreatePanel(attachment.name);
+        if(attachment.hasTitle) {
+            panel->setTitle(attachment.title);
+        }
+        tree->attachPanel(attachment.split, attachment.slot, panel);
+    }
+
+    return tree;
+}
+
+void LayoutFile::load() {
+    LayoutTree * parsed = parse();
+    if(layout == NULL) {
+        layout = parsed;
+        layout->layout();
+    } else {
+        layout->replace(*parsed);
+        delete parsed;
+    }
+
+    if(watcher == NULL) {
+        watcher = new FileWatcher(path);
+    }
+
+    lastError = "";
+}
+
+bool LayoutFile::poll() {
+    if(watcher == NULL || !watcher->changed()) { return false; }
+
+    try {
+        load();
+    } catch(InvalidLayoutException& e) {
+        lastError = e.what();
+        return false;
+    }
+
+    return true;
+}
+
+LayoutTree * LayoutFile::getLayout() {
+    return layout;
+}
+
+Panel * LayoutFile::getPanel(std::string name) {
+    auto iter = panels.find(name);
+    return (iter != panels.end()) ? iter->second : NULL;
+}
+
+const std::string & LayoutFile::getError() {
+    return lastError;
+}
+
+////////////////////////////////// THEMES ///////////////////////////////////
+
+// Color names allowed in theme files
+static const std::map<std::string, short> themeColors = {
+    {"default", -1},
+    {"black", COLOR_BLACK},
+    {"red", COLOR_RED},
+    {"green", COLOR_GREEN},
+    {"yellow", COLOR_YELLOW},
+    {"blue", COLOR_BLUE},
+    {"magenta", COLOR_MAGENTA},
+    {"cyan", COLOR_CYAN},
+    {"white", COLOR_WHITE}
+};
+
+Theme * Theme::active = NULL;
+
+Theme::Theme() : watcher(NULL), generation(0), nextPair(8) {
+    // The Engine already made pairs for each color on the default background
+    for(short color = 1; color < 8; color++) {
+        pairs[{color, -1}] = color;
+    }
+
+    const char * builtins[] = { "normal", "title", "border", "selection", "error" };
+    for(const char * role : builtins) {
+        roles.push_back(role);
+        styles.push_back(A_NORMAL);
+    }
+}
+
+Theme::~Theme() {
+    if(active == this) {
+        active = NULL;
+    }
+    delete watcher;
+}
+
+int Theme::getStyle(std::string role) {
+    for(size_t handle = 0; handle < roles.size(); handle++) {
+        if(roles[handle] == role) {
+            return handle;
+        }
+    }
+
+    roles.push_back(role);
+    auto iter = specs.find(role);
+    styles.push_back((iter != specs.end()) ? iter->second : A_NORMAL);
+
+    return roles.size() - 1;
+}
+
+short Theme::allocatePair(short foreground, short background) {
+    if(lowBandwidth) {
+        foreground = basicColor(foreground);
+        background = basicColor(background);
+    }
+
+    auto iter = pairs.find({foreground, background});
+    if(iter != pairs.end()) {
+        return iter->second;
+    }
+
+    // Out of pairs, so settle for the foreground on the default background
+    if(nextPair >= COLOR_PAIRS) {
+        iter = pairs.find({foreground, -1});
+        return (iter != pairs.end()) ? iter->second : 0;
+    }
+
+    initSharedPair(nextPair, foreground, background);
+    pairs[{foreground, background}] = nextPair;
+    return nextPair++;
+}
+
+int Theme::parseSpec(const std::string & spec, const std::string & where) {
+    std::stringstream ss(spec);
+    std::string token;
+    int attr = A_NORMAL;
+    short foreground = -1, background = -1;
+    bool hasColor = false, nextIsBackground = false;
+
+    while(ss >> token) {
+        if(token == "on") {
+            nextIsBackground = true;
+            continue;
+        }
+
+        // Colors are names or plain numbers, anything else is an attribute
+        short color;
+        auto iter = themeColors.find(token);
+        if(iter != themeColors.end()) {
+            color = iter->second;
+        } else if(token.find_first_not_of("0123456789") == std::string::npos) {
+            color = (token.size() > 4) ? COLORS : (short)std::stoi(token);
+            if(color >= COLORS) {
+                throw InvalidThemeException(where + "Color " + token + " is not supported here.");
+            }
+        } else {
+            int named = getAttribute(token);
+            if(named == A_NORMAL || (named & A_COLOR)) {
+                throw InvalidThemeException(where + "Unknown attribute '" + token + "'.");
+            }
+            attr |= named;
+            continue;
+        }
+
+        if(nextIsBackground) {
+            background = color;
+            nextIsBackground = false;
+        } else {
+            foreground = color;
+        }
+        hasColor = true;
+    }
+
+    if(nextIsBackground) {
+        throw InvalidThemeException(where + "Missing background color after 'on'.");
+    }
+
+    if(hasColor) {
+        attr |= COLOR_PAIR(allocatePair(foreground, background));
+    }
+
+    return attr;
+}
+
+void Theme::resolve() {
+    for(size_t handle = 0; handle < roles.size(); handle++) {
+        auto iter = specs.find(roles[handle]);
+        styles[handle] = (iter != specs.end()) ? iter->second : A_NORMAL;
+    }
+    generation++;
+}
+
+void Theme::load(std::string pathIn) {
+    std::ifstream file(pathIn);
+    if(!file) {
+        throw InvalidThemeException("Could not open theme file " + pathIn + ".");
+    }
+
+    // Parse into a fresh map, so a bad file leaves the old styles alone
+    std::map<std::string, int> newSpecs;
+    std::string line;
+    int number = 0;
+    while(std::getline(file, line)) {
+        number++;
+        std::string where = "Line " + std::to_string(number) + ": ";
+
+        size_t start = line.find_first_not_of(" \t");
+        if(start == std::string::npos || line[start] == '#') { continue; }
+
+        size_t equals = line.find('=');
+        if(equals == std::string::npos) {
+            throw InvalidThemeException(where + "Expected 'role = attributes'.");
+        }
+
+        std::stringstream roleStream(line.substr(0, equals));
+        std::string role;
+        roleStream >> role;
+        if(role.empty()) {
+            throw InvalidThemeException(where + "Missing role name.");
+        }
+
+        newSpecs[role] = parseSpec(line.substr(equals + 1), where);
+    }
+
+    specs = newSpecs;
+    resolve();
+
+    if(watcher == NULL || path != pathIn) {
+        delete watcher;
+        watcher = new FileWatcher(pathIn);
+    }
+    path = pathIn;
+    lastError = "";
+}
+
+bool Theme::poll() {
+    if(watcher == NULL || !watcher->changed()) { return false; }
+
+    try {
+        load(path);
+    } catch(InvalidThemeException& e) {
+        lastError = e.what();
+        return false;
+    }
+
+    return true;
+}
+
+const std::string & Theme::getError() {
+    return lastError;
+}
+
+int Theme::getGeneration() {
+    return generation;
+}
+
+void Theme::setActive(Theme * theme) {
+    active = theme;
+}
+
+Theme * Theme::getActive() {
+    return active;
 }